@@ -0,0 +1,100 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aot.h"
+#include "device.h"
+#include "jit_emit.h"
+#include "reu.h"
+#include "riscv.h"
+#include "riscv_private.h"
+
+#if SEMU_HAS(AOT)
+
+uint32_t aot_first_page, aot_pages;
+
+static aot_header_t aot;
+/* one bit per directory entry, set if the overlay must not be used */
+static uint8_t aot_dropped[RAM_SIZE / RV_PAGE_SIZE / 8];
+static uint8_t aot_window[AOT_WINDOW_SIZE];
+static uint32_t aot_loaded; /**< page in the window | 1, 0 if none */
+static uint8_t aot_blocks;
+
+bool aot_init(vm_t *vm)
+{
+    reu_read(&aot, AOT_REU_BASE, sizeof(aot));
+    if (aot.magic != (SEMU_HAS(REG_PLANES) ? AOT_MAGIC_PLANES : AOT_MAGIC) ||
+        aot.regs != (uint16_t) (uintptr_t) vm->x_regs ||
+        aot.window > AOT_WINDOW_SIZE ||
+        aot.pages > RAM_SIZE / RV_PAGE_SIZE - aot.first_page)
+        return false;
+    aot_first_page = aot.first_page;
+    aot_pages = aot.pages;
+    return true;
+}
+
+void aot_drop_page(uint32_t page)
+{
+    page -= aot_first_page;
+    aot_dropped[page >> 3] |= 1 << (page & 7);
+    if (aot_loaded == ((page << 1) | 1))
+        aot_loaded = 0;
+}
+
+/* Copy the overlay of the directory entry page into the window */
+static bool aot_load(uint32_t page)
+{
+    aot_page_t dir;
+
+    if (aot_dropped[page >> 3] & (1 << (page & 7)))
+        return false;
+    reu_read(&dir, AOT_REU_BASE + sizeof(aot) + page * sizeof(dir),
+             sizeof(dir));
+    if (!dir.offset) {
+        aot_dropped[page >> 3] |= 1 << (page & 7);
+        return false;
+    }
+    reu_read(aot_window, AOT_REU_BASE + dir.offset, dir.size);
+    aot_loaded = (page << 1) | 1;
+    aot_blocks = dir.blocks;
+    return true;
+}
+
+static const aot_block_t *aot_find(uint16_t off)
+{
+    const aot_block_t *blocks = (const aot_block_t *) aot_window;
+    uint8_t lo = 0, hi = aot_blocks;
+
+    while (lo < hi) {
+        const uint8_t mid = ((uint16_t) lo + hi) >> 1;
+        if (blocks[mid].off < off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < aot_blocks && blocks[lo].off == off ? &blocks[lo] : NULL;
+}
+
+uint16_t aot_run(vm_t *vm, uint32_t addr, uint16_t budget)
+{
+    const aot_block_t *blocks = (const aot_block_t *) aot_window;
+    const uint32_t page = (addr >> RV_PAGE_SHIFT) - aot_first_page;
+    uint16_t steps = 0;
+
+    if (page >= aot_pages || vm->pc - addr != aot.vdelta)
+        return 0;
+    if (aot_loaded != ((page << 1) | 1) && !aot_load(page))
+        return 0;
+
+    const aot_block_t *b = aot_find(addr & MASK(RV_PAGE_SHIFT));
+    while (b && b->len <= budget) {
+        const uint8_t exit = ((jit_code_t) (aot_window + b->code))();
+        vm->current_pc = vm->pc + 4 * (uint32_t) (b->len - 1);
+        vm->pc += b->exit[exit];
+        budget -= b->len;
+        steps += b->len;
+        b = b->next[exit] == AOT_NONE ? NULL : &blocks[b->next[exit]];
+    }
+    return steps;
+}
+
+#endif
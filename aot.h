@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "riscv.h"
+#include "riscv_private.h"
+
+/* Ahead-of-time translated kernel text
+ *
+ * tools/aotgen translates the pages of a fixed kernel text with the same
+ * emitter as the runtime translator (jit_emit.c) and stores the result in an
+ * unused region of the REU image at AOT_REU_BASE:
+ *
+ *   aot_header_t  header
+ *   aot_page_t    directory[header.pages]
+ *   overlays      aot_block_t blocks[], sorted by offset, then native code
+ *
+ * At runtime the overlay of the guest page being executed is copied into a
+ * window in C64 RAM, where its blocks run and chain without the
+ * interpreter. Everything else, and every page the guest stores to, is left
+ * to the interpreter. Multi-byte fields are little endian, and the
+ * structures are laid out without padding on the host as well.
+ */
+
+#ifndef AOT_REU_BASE
+#define AOT_REU_BASE 0xF00000UL /* the tail of the phram region */
+#endif
+
+#ifndef AOT_WINDOW_SIZE
+#define AOT_WINDOW_SIZE 0x2000 /* bytes, the biggest overlay */
+#endif
+
+#define AOT_MAGIC 0x31544F41UL        /* "AOT1" */
+#define AOT_MAGIC_PLANES 0x50544F41UL /* "AOTP", for REG_PLANES builds */
+#define AOT_NONE 0xFF                 /* exit leaves the page */
+
+typedef struct {
+    uint32_t magic;
+    uint16_t regs;       /**< register file address the code was built for */
+    uint16_t window;     /**< size of the biggest overlay */
+    uint32_t vdelta;     /**< virtual minus physical address of the text */
+    uint32_t first_page; /**< physical page number of directory[0] */
+    uint32_t pages;      /**< directory entries */
+} aot_header_t;
+
+typedef struct {
+    uint32_t offset; /**< of the overlay from AOT_REU_BASE, 0 if none */
+    uint16_t size;   /**< of the overlay in bytes */
+    uint16_t blocks; /**< entries at the start of the overlay */
+} aot_page_t;
+
+typedef struct {
+    int32_t exit[2]; /**< next pc for each exit, relative to the block */
+    uint16_t off;    /**< page offset of the first guest instruction */
+    uint16_t code;   /**< offset of the native code in the overlay */
+    uint8_t len;     /**< guest instructions */
+    uint8_t next[2]; /**< block at exit[] in the same page, or AOT_NONE */
+    uint8_t reserved;
+} aot_block_t;
+
+_Static_assert(sizeof(aot_header_t) == 20, "aot_header_t is padded");
+_Static_assert(sizeof(aot_page_t) == 8, "aot_page_t is padded");
+_Static_assert(sizeof(aot_block_t) == 16, "aot_block_t is padded");
+
+#if SEMU_HAS(AOT)
+/* Look for overlays built for vm, returns false if there are none */
+bool aot_init(vm_t *vm);
+
+/* Run translated blocks starting at vm->pc, whose guest physical address is
+ * addr, like jit_run(). Returns zero if there is no overlay block for addr.
+ */
+uint16_t aot_run(vm_t *vm, uint32_t addr, uint16_t budget);
+
+/* translated physical pages, empty if there are no overlays */
+extern uint32_t aot_first_page, aot_pages;
+
+void aot_drop_page(uint32_t page);
+
+/* Stop using the overlay of the page a store to the physical address addr
+ * hits, its code might have been changed.
+ */
+static inline void aot_snoop(uint32_t addr)
+{
+    const uint32_t page = addr >> RV_PAGE_SHIFT;
+    if (unlikely(page - aot_first_page < aot_pages))
+        aot_drop_page(page);
+}
+#else
+static inline uint16_t aot_run(vm_t *vm UNUSED,
+                               uint32_t addr UNUSED,
+                               uint16_t budget UNUSED)
+{
+    return 0;
+}
+static inline void aot_snoop(uint32_t addr UNUSED) {}
+#endif
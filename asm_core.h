@@ -0,0 +1,80 @@
+#pragma once
+
+/* Hand-written 6502 handlers for the most frequent instructions
+ *
+ * asm_core.S runs predecoded register-only instructions, branches and jumps
+ * on the byte-plane register file (REG_PLANES), reaching plane k through a
+ * zero page pointer set up by asm_core_bind(). vm_exec() calls them instead
+ * of its C cases; everything else stays in C. The handlers take the
+ * decoded_insn_t and rely on decode_pseudo(), that is no handler is called
+ * for an instruction writing x0 except the jumps and lw.
+ *
+ * With STATIC_BUS, lw and sw of a word in RAM are done here as well if the
+ * MMU is off or the page is in the translation cache of riscv.c. A miss,
+ * MMIO, a misaligned address and, for sw, a held LR reservation are left to
+ * the C path.
+ */
+
+/* structure offsets used by asm_core.S */
+#define ASM_D_IMM 8
+#define ASM_D_RD 13
+#define ASM_D_RS1 14
+#define ASM_D_RS2 15
+#define ASM_VM_LR_RESERVATION 128
+#define ASM_VM_PC 132
+#define ASM_VM_CURRENT_PC 136
+
+/* results of the branch, jump, load and store handlers */
+#define ASM_NEXT 0  /* not taken, or done */
+#define ASM_TAKEN 1 /* vm->pc is the target */
+#define ASM_SLOW 2  /* nothing done, use the C path */
+
+#ifndef __ASSEMBLER__
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decode.h"
+#include "riscv.h"
+
+#if SEMU_HAS(ASM_CORE) && !SEMU_HAS(REG_PLANES)
+#error "ASM_CORE needs the REG_PLANES register file"
+#endif
+
+_Static_assert(offsetof(decoded_insn_t, imm) == ASM_D_IMM, "asm_core.S");
+_Static_assert(offsetof(decoded_insn_t, rd) == ASM_D_RD, "asm_core.S");
+_Static_assert(offsetof(decoded_insn_t, rs1) == ASM_D_RS1, "asm_core.S");
+_Static_assert(offsetof(decoded_insn_t, rs2) == ASM_D_RS2, "asm_core.S");
+_Static_assert(offsetof(vm_t, x_regs) == 0, "asm_core.S");
+_Static_assert(offsetof(vm_t, lr_reservation) == ASM_VM_LR_RESERVATION,
+               "asm_core.S");
+_Static_assert(offsetof(vm_t, pc) == ASM_VM_PC, "asm_core.S");
+_Static_assert(offsetof(vm_t, current_pc) == ASM_VM_CURRENT_PC, "asm_core.S");
+
+/* Make the handlers work on vm, whose register file is 128-byte aligned */
+void asm_core_bind(vm_t *vm);
+
+void asm_op_li(const decoded_insn_t *d);   /* rd = imm */
+void asm_op_mv(const decoded_insn_t *d);   /* rd = rs1 */
+void asm_op_addi(const decoded_insn_t *d); /* rd = rs1 + imm */
+void asm_op_andi(const decoded_insn_t *d); /* rd = rs1 & imm */
+void asm_op_add(const decoded_insn_t *d);  /* rd = rs1 + rs2 */
+void asm_op_slli(const decoded_insn_t *d); /* rd = rs1 << imm */
+void asm_op_srli(const decoded_insn_t *d); /* rd = rs1 >> imm */
+
+/* pc relative to current_pc, the jumps link vm->pc to rd */
+uint8_t asm_op_beq(const decoded_insn_t *d);
+uint8_t asm_op_bne(const decoded_insn_t *d);
+uint8_t asm_op_beqz(const decoded_insn_t *d);
+uint8_t asm_op_bnez(const decoded_insn_t *d);
+uint8_t asm_op_jal(const decoded_insn_t *d);
+uint8_t asm_op_jalr(const decoded_insn_t *d); /* (rs1 + imm) & ~1 */
+
+/* rd = word at rs1 + imm, word at rs1 + imm = rs2 */
+uint8_t asm_op_lw(const decoded_insn_t *d);
+uint8_t asm_op_sw(const decoded_insn_t *d);
+
+/* The rest of the stores asm_op_sw() takes, in riscv.c: dropping what was
+ * translated from the word at the RAM address addr, then the store itself.
+ */
+void asm_store_word(uint32_t addr, uint32_t value);
+#endif
@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "bitmanip.h"
+
+/* leading zeros and set bits of the bytes 0..255 */
+#define CLZ8(n)                                                          \
+    ((n) >= 128 ? 0                                                      \
+     : (n) >= 64 ? 1                                                     \
+     : (n) >= 32 ? 2                                                     \
+     : (n) >= 16 ? 3                                                     \
+     : (n) >= 8  ? 4                                                     \
+     : (n) >= 4  ? 5                                                     \
+     : (n) >= 2  ? 6                                                     \
+     : (n)       ? 7                                                     \
+                 : 8)
+#define POP8(n)                                                          \
+    (((n) & 1) + ((n) >> 1 & 1) + ((n) >> 2 & 1) + ((n) >> 3 & 1) +     \
+     ((n) >> 4 & 1) + ((n) >> 5 & 1) + ((n) >> 6 & 1) + ((n) >> 7 & 1))
+#define BYTE4(f, n) f(n), f(n + 1), f(n + 2), f(n + 3)
+#define BYTE16(f, n) \
+    BYTE4(f, n), BYTE4(f, n + 4), BYTE4(f, n + 8), BYTE4(f, n + 12)
+#define BYTE64(f, n) \
+    BYTE16(f, n), BYTE16(f, n + 16), BYTE16(f, n + 32), BYTE16(f, n + 48)
+#define BYTE256(f, n) \
+    BYTE64(f, n), BYTE64(f, n + 64), BYTE64(f, n + 128), BYTE64(f, n + 192)
+
+static const uint8_t clz8[256] = {BYTE256(CLZ8, 0)};
+static const uint8_t pop8[256] = {BYTE256(POP8, 0)};
+
+uint8_t clz32(uint32_t x)
+{
+    uint8_t b[4];
+    memcpy(b, &x, sizeof(b));
+
+    uint8_t n = 0;
+    for (uint8_t i = 4; i--; n += 8) {
+        if (b[i])
+            return n + clz8[b[i]];
+    }
+    return 32;
+}
+
+uint8_t ctz32(uint32_t x)
+{
+    uint8_t b[4];
+    memcpy(b, &x, sizeof(b));
+
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < 4; i++, n += 8) {
+        /* b & -b keeps the lowest set bit only */
+        if (b[i])
+            return n + 7 - clz8[b[i] & (uint8_t) -b[i]];
+    }
+    return 32;
+}
+
+uint8_t cpop32(uint32_t x)
+{
+    uint8_t b[4];
+    memcpy(b, &x, sizeof(b));
+    return pop8[b[0]] + pop8[b[1]] + pop8[b[2]] + pop8[b[3]];
+}
+
+uint32_t ror32(uint32_t x, uint8_t n)
+{
+    uint8_t b[4], r[4];
+    memcpy(b, &x, sizeof(b));
+
+    /* whole bytes first, then each byte takes the low bits of the next */
+    const uint8_t k = n >> 3 & 3, s = n & 7;
+    for (uint8_t i = 0; i < 4; i++) {
+        const uint8_t lo = b[(i + k) & 3], hi = b[(i + k + 1) & 3];
+        r[i] = s ? (uint8_t) (lo >> s | hi << (8 - s)) : lo;
+    }
+    memcpy(&x, r, sizeof(x));
+    return x;
+}
+
+uint32_t rev8_32(uint32_t x)
+{
+    uint8_t b[4], r[4];
+    memcpy(b, &x, sizeof(b));
+    r[0] = b[3];
+    r[1] = b[2];
+    r[2] = b[1];
+    r[3] = b[0];
+    memcpy(&x, r, sizeof(x));
+    return x;
+}
+
+uint32_t orcb32(uint32_t x)
+{
+    uint8_t b[4];
+    memcpy(b, &x, sizeof(b));
+    for (uint8_t i = 0; i < 4; i++)
+        b[i] = b[i] ? 0xFF : 0;
+    memcpy(&x, b, sizeof(x));
+    return x;
+}
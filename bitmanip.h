@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Bit counting and rotation for the Zbb extension
+ *
+ * Counting bits one shift at a time takes up to 32 rounds of four-byte
+ * shifts on the 6502. Here the zero bytes are skipped and the byte the
+ * answer lies in is looked up in a 256-entry table, and rotations move
+ * whole bytes before shifting by the remaining zero to seven bits.
+ */
+
+/* Leading zero bits of x, 32 if it is zero */
+uint8_t clz32(uint32_t x);
+
+/* Trailing zero bits of x, 32 if it is zero */
+uint8_t ctz32(uint32_t x);
+
+/* Set bits in x */
+uint8_t cpop32(uint32_t x);
+
+/* x rotated right by n & 31 bits */
+uint32_t ror32(uint32_t x, uint8_t n);
+
+/* x with its bytes reversed */
+uint32_t rev8_32(uint32_t x);
+
+/* x with each non-zero byte set to all ones */
+uint32_t orcb32(uint32_t x);
@@ -0,0 +1,85 @@
+#pragma once
+
+/* Memory bus of semu, bound at compile time with STATIC_BUS
+ *
+ * riscv.c then calls these directly instead of going through the
+ * mem_fetch, mem_load, mem_store and mem_zero callbacks of vm_t, so that
+ * the RAM case inlines into the interpreter and only device accesses take
+ * a call. Without STATIC_BUS, main.c makes its callbacks out of them.
+ */
+
+#include "device.h"
+#include "riscv.h"
+#include "riscv_private.h"
+
+#include "reu.h"
+
+/* Device accesses at addr >= RAM_SIZE, an access fault if there is none */
+void bus_load_mmio(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value);
+void bus_store_mmio(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value);
+
+/* Fetch is simpler (fixed width, already checked alignment, only main RAM
+ * is executable). It goes through the fetch line of reu.c, which loads and
+ * stores do not evict.
+ */
+static inline void bus_fetch(vm_t *vm, uint32_t addr, uint32_t *value)
+{
+    if (unlikely(addr >= RAM_SIZE)) {
+        /* TODO: check for other regions */
+        vm_set_exception(vm, RV_EXC_FETCH_FAULT, vm->exc_val);
+        return;
+    }
+    *value = fetchword_reu(addr & 0xfffffffc);
+}
+
+/* A page table entry for the MMU, read through the data cache of reu.c, so
+ * that page walks leave the fetch line alone. Returns false outside of RAM,
+ * without raising anything: the MMU raises the fault of the access it
+ * translates for.
+ */
+static inline bool bus_load_pte(vm_t *vm UNUSED,
+                                uint32_t addr,
+                                uint32_t *value)
+{
+    if (unlikely(addr >= RAM_SIZE))
+        return false;
+    *value = loadword_reu(addr & 0xfffffffc);
+    return true;
+}
+
+static inline void bus_load(vm_t *vm,
+                            uint32_t addr,
+                            uint8_t width,
+                            uint32_t *value)
+{
+    if (likely(addr < RAM_SIZE)) {
+        ram_read(vm, ((emu_state_t *) vm->priv)->ram, addr, width, value);
+        return;
+    }
+    bus_load_mmio(vm, addr, width, value);
+}
+
+static inline void bus_store(vm_t *vm,
+                             uint32_t addr,
+                             uint8_t width,
+                             uint32_t value)
+{
+    if (likely(addr < RAM_SIZE)) {
+        ram_write(vm, ((emu_state_t *) vm->priv)->ram, addr, width, value);
+        return;
+    }
+    bus_store_mmio(vm, addr, width, value);
+}
+
+/* Zero len bytes at the aligned addr for cbo.zero. Only RAM can be zeroed
+ * that way, the devices take single stores. Returns false if the caller has
+ * to zero them a word at a time, which is never the case here.
+ */
+static inline bool bus_zero(vm_t *vm, uint32_t addr, uint16_t len)
+{
+    if (addr < RAM_SIZE)
+        ram_zero(vm, ((emu_state_t *) vm->priv)->ram, addr, len);
+    else
+        vm_set_exception(vm, RV_EXC_STORE_FAULT, vm->exc_val);
+    return true;
+}
@@ -20,12 +20,22 @@
 #include <stdarg.h>
 
 #include "debug.h"
+#include "device.h"
 #include "keyboard.h"
 #include "display.h"
 #include "reu.h"
 
+#if SEMU_HAS(INSN_STATS)
+    #define DEBUG_WINDOW_Y          2
+    #define DEBUG_WINDOW_HEIGHT     22      /** @brief with the fast path hit counters */
+#else
+    #define DEBUG_WINDOW_Y          5
+    #define DEBUG_WINDOW_HEIGHT     16
+#endif
+
 uint8_t  debug_menu( vm_t *vm ) {
     static struct region *region = NULL;
+    emu_state_t *emu = (emu_state_t *) vm->priv;
     /*
      * check if debug window is active
      */
@@ -35,9 +45,22 @@ uint8_t  debug_menu( vm_t *vm ) {
          */
         display_set_cursor( 0, 0 );
         display_printf("  INSN: %08lX:%08lX\n", vm->insn_count_hi, vm->insn_count );
-        display_printf("    PC: 0x%08lX  SIE: %08lX\n\n", vm->current_pc, vm->sie );
+        display_printf("  IDLE: %08lX:%08lX\n", emu->idle_hi, emu->idle_lo );
+        display_printf("    PC: 0x%08lX  SIE: %08lX\n", vm->current_pc, vm->sie );
+        display_printf("   REU: hit %08lX  miss %08lX\n", reu_hits, reu_misses );
         for( size_t i = 0 ; i < 8; i++ )
-            display_printf("  %08lX %08lX %08lX %08lX\n", loadword_reu( vm->x_regs[ i * 4 ] ), loadword_reu( vm->x_regs[ i * 4 + 1 ] ), loadword_reu( vm->x_regs[ i * 4 + 2 ] ), loadword_reu( vm->x_regs[ i * 4 + 3 ] ) );
+            display_printf("  %08lX %08lX %08lX %08lX\n", loadword_reu( vm_get_reg( vm, i * 4 ) ), loadword_reu( vm_get_reg( vm, i * 4 + 1 ) ), loadword_reu( vm_get_reg( vm, i * 4 + 2 ) ), loadword_reu( vm_get_reg( vm, i * 4 + 3 ) ) );
+#if SEMU_HAS(INSN_STATS)
+        display_printf("\n  mv:%08lX  li:%08lX  nop:%08lX\n", vm_insn_hits[ 0 ], vm_insn_hits[ 1 ], vm_insn_hits[ 2 ] );
+        display_printf("  j:%08lX  jr:%08lX  beqz:%08lX\n", vm_insn_hits[ 3 ], vm_insn_hits[ 4 ], vm_insn_hits[ 5 ] );
+#if SEMU_HAS(MISALIGNED)
+        display_printf("  bnez:%08lX  misaligned:%08lX\n", vm_insn_hits[ 6 ], ram_misaligned );
+#else
+        display_printf("  bnez:%08lX\n", vm_insn_hits[ 6 ] );
+#endif
+        display_printf("  lui+addi:%08lX  auipc+jalr:%08lX\n", vm_insn_hits[ 7 ], vm_insn_hits[ 8 ] );
+        display_printf("  auipc+lw:%08lX  slli+srli:%08lX\n", vm_insn_hits[ 9 ], vm_insn_hits[ 10 ] );
+#endif
         display_printf("\n  s = single step, C= to continue");
     }
     else {
@@ -45,7 +68,12 @@ uint8_t  debug_menu( vm_t *vm ) {
          * create debug window when C= is pressed
          */
         if( keyboard_c_check() ) {
-            region = display_save_region( 20, 5, 41, 15 );
+            /*
+             * bring the reu up to date, so that it can be looked at while
+             * stopped here
+             */
+            reu_flush();
+            region = display_save_region( 20, DEBUG_WINDOW_Y, 41, DEBUG_WINDOW_HEIGHT );
             display_set_cursor_active( 0 );
             return( 0 );
         }
@@ -0,0 +1,284 @@
+#include <string.h>
+
+#include "decode.h"
+#include "riscv_private.h"
+
+/* decode_slots[], decode_subs[], decode_formats[] and decode_imm(), which
+ * make tools/gendecode from the instruction patterns in decode.isa
+ */
+#include "decode_table.h"
+
+_Static_assert(OP_SLLI_SRLI < DECODE_SUB, "handler clashes with DECODE_SUB");
+
+/* The handler of the decode_subs[] pattern from i on that the instruction
+ * bytes b[] fit, the list ends in one that fits anything
+ */
+static uint8_t decode_sub(uint8_t i, const uint8_t *b)
+{
+    for (;; i++) {
+        const decode_pattern_t *p = &decode_subs[i];
+        if ((b[0] & p->mask[0]) == p->match[0] &&
+            (b[1] & p->mask[1]) == p->match[1] &&
+            (b[2] & p->mask[2]) == p->match[2] &&
+            (b[3] & p->mask[3]) == p->match[3])
+            return p->op;
+    }
+}
+
+#if SEMU_HAS(RVC)
+/* bits hi..lo of the compressed instruction c */
+#define C_BITS(c, hi, lo) (((c) >> (lo)) & MASK((hi) - (lo) + 1))
+
+/* x sign-extended from n bits */
+static uint32_t sext(uint32_t x, uint8_t n)
+{
+    return (uint32_t) ((int32_t) (x << (32 - n)) >> (32 - n));
+}
+
+static uint32_t enc_r(uint8_t opcode,
+                      uint8_t funct3,
+                      uint8_t funct7,
+                      uint8_t rd,
+                      uint8_t rs1,
+                      uint8_t rs2)
+{
+    return (uint32_t) funct7 << 25 | (uint32_t) rs2 << 20 |
+           (uint32_t) rs1 << 15 | (uint32_t) funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t enc_i(uint8_t opcode,
+                      uint8_t funct3,
+                      uint8_t rd,
+                      uint8_t rs1,
+                      uint32_t imm)
+{
+    return imm << 20 | (uint32_t) rs1 << 15 | (uint32_t) funct3 << 12 |
+           rd << 7 | opcode;
+}
+
+static uint32_t enc_sw(uint8_t rs1, uint8_t rs2, uint32_t imm)
+{
+    return (imm >> 5) << 25 | (uint32_t) rs2 << 20 | (uint32_t) rs1 << 15 |
+           (uint32_t) RV_MEM_SW << 12 | (imm & MASK(5)) << 7 | RV32_STORE;
+}
+
+static uint32_t enc_b(uint8_t funct3, uint8_t rs1, uint32_t imm)
+{
+    return (imm >> 12 & 1) << 31 | (imm >> 5 & MASK(6)) << 25 |
+           (uint32_t) rs1 << 15 | (uint32_t) funct3 << 12 |
+           (imm >> 1 & MASK(4)) << 8 | (imm >> 11 & 1) << 7 | RV32_BRANCH;
+}
+
+static uint32_t enc_j(uint8_t rd, uint32_t imm)
+{
+    return (imm >> 20 & 1) << 31 | (imm >> 1 & MASK(10)) << 21 |
+           (imm >> 11 & 1) << 20 | (imm & (MASK(8) << 12)) | rd << 7 |
+           RV32_JAL;
+}
+
+/* The 32-bit instruction the compressed instruction c stands for, zero for
+ * the illegal and reserved encodings and for those of the F and D
+ * extensions. HINTs expand to their no-op base instruction.
+ */
+static uint32_t decode_expand(uint16_t c)
+{
+    const uint8_t rd = C_BITS(c, 11, 7), rs2 = C_BITS(c, 6, 2);
+    const uint8_t rd_ = 8 + C_BITS(c, 4, 2), rs1_ = 8 + C_BITS(c, 9, 7);
+    const uint32_t imm6 = sext(C_BITS(c, 12, 12) << 5 | C_BITS(c, 6, 2), 6);
+    uint32_t imm;
+
+    switch ((c & 0b11) << 3 | C_BITS(c, 15, 13)) {
+    case 0b00000: /* C.ADDI4SPN */
+        imm = C_BITS(c, 12, 11) << 4 | C_BITS(c, 10, 7) << 6 |
+              C_BITS(c, 6, 6) << 2 | C_BITS(c, 5, 5) << 3;
+        return imm ? enc_i(RV32_OP_IMM, 0, rd_, 2, imm) : 0;
+    case 0b00010: /* C.LW */
+    case 0b00110: /* C.SW */
+        imm = C_BITS(c, 12, 10) << 3 | C_BITS(c, 6, 6) << 2 |
+              C_BITS(c, 5, 5) << 6;
+        if (c & (1 << 15))
+            return enc_sw(rs1_, rd_, imm);
+        return enc_i(RV32_LOAD, RV_MEM_LW, rd_, rs1_, imm);
+
+    case 0b01000: /* C.ADDI, C.NOP */
+        return enc_i(RV32_OP_IMM, 0, rd, rd, imm6);
+    case 0b01001: /* C.JAL */
+    case 0b01101: /* C.J */
+        imm = C_BITS(c, 12, 12) << 11 | C_BITS(c, 11, 11) << 4 |
+              C_BITS(c, 10, 9) << 8 | C_BITS(c, 8, 8) << 10 |
+              C_BITS(c, 7, 7) << 6 | C_BITS(c, 6, 6) << 7 |
+              C_BITS(c, 5, 3) << 1 | C_BITS(c, 2, 2) << 5;
+        return enc_j(c & (1 << 15) ? 0 : 1, sext(imm, 12));
+    case 0b01010: /* C.LI */
+        return enc_i(RV32_OP_IMM, 0, rd, 0, imm6);
+    case 0b01011:
+        if (rd == 2) { /* C.ADDI16SP */
+            imm = C_BITS(c, 12, 12) << 9 | C_BITS(c, 6, 6) << 4 |
+                  C_BITS(c, 5, 5) << 6 | C_BITS(c, 4, 3) << 7 |
+                  C_BITS(c, 2, 2) << 5;
+            return imm ? enc_i(RV32_OP_IMM, 0, 2, 2, sext(imm, 10)) : 0;
+        }
+        /* C.LUI */
+        return imm6 ? (imm6 << 12 | rd << 7 | RV32_LUI) : 0;
+    case 0b01100:
+        switch (C_BITS(c, 11, 10)) {
+        case 0b00: /* C.SRLI */
+        case 0b01: /* C.SRAI, shamt[5] is reserved in RV32 */
+            if (c & (1 << 12))
+                return 0;
+            return enc_i(RV32_OP_IMM, 0b101, rs1_, rs1_,
+                         C_BITS(c, 10, 10) << 10 | rs2);
+        case 0b10: /* C.ANDI */
+            return enc_i(RV32_OP_IMM, 0b111, rs1_, rs1_, imm6);
+        default: {
+            /* C.SUB, C.XOR, C.OR, C.AND, the others are RV64 only */
+            static const uint8_t funct3[4] = {0b000, 0b100, 0b110, 0b111};
+            if (c & (1 << 12))
+                return 0;
+            return enc_r(RV32_OP, funct3[C_BITS(c, 6, 5)],
+                         C_BITS(c, 6, 5) ? 0 : 0b0100000, rs1_, rs1_, rd_);
+        }
+        }
+    case 0b01110: /* C.BEQZ */
+    case 0b01111: /* C.BNEZ */
+        imm = C_BITS(c, 12, 12) << 8 | C_BITS(c, 11, 10) << 3 |
+              C_BITS(c, 6, 5) << 6 | C_BITS(c, 4, 3) << 1 |
+              C_BITS(c, 2, 2) << 5;
+        return enc_b(C_BITS(c, 13, 13), rs1_, sext(imm, 9));
+
+    case 0b10000: /* C.SLLI, shamt[5] is reserved in RV32 */
+        if (c & (1 << 12))
+            return 0;
+        return enc_i(RV32_OP_IMM, 0b001, rd, rd, rs2);
+    case 0b10010: /* C.LWSP */
+        imm = C_BITS(c, 12, 12) << 5 | C_BITS(c, 6, 4) << 2 |
+              C_BITS(c, 3, 2) << 6;
+        return rd ? enc_i(RV32_LOAD, RV_MEM_LW, rd, 2, imm) : 0;
+    case 0b10100:
+        if (!(c & (1 << 12))) {
+            if (rs2) /* C.MV */
+                return enc_r(RV32_OP, 0, 0, rd, 0, rs2);
+            /* C.JR */
+            return rd ? enc_i(RV32_JALR, 0, 0, rd, 0) : 0;
+        }
+        if (rs2) /* C.ADD */
+            return enc_r(RV32_OP, 0, 0, rd, rd, rs2);
+        if (rd) /* C.JALR */
+            return enc_i(RV32_JALR, 0, 1, rd, 0);
+        return enc_i(RV32_SYSTEM, 0, 0, 0, 1); /* C.EBREAK */
+    case 0b10110: /* C.SWSP */
+        imm = C_BITS(c, 12, 9) << 2 | C_BITS(c, 8, 7) << 6;
+        return enc_sw(2, rs2, imm);
+    default:
+        return 0;
+    }
+}
+#endif
+
+void decode_insn(decoded_insn_t *d, uint32_t insn)
+{
+#if SEMU_HAS(RVC)
+    /* a compressed instruction is decoded as the one it stands for, whose
+     * word is kept with bit 0 cleared to tell the two apart
+     */
+    const bool compressed = (insn & 0b11) != 0b11;
+    if (compressed)
+        insn = decode_expand(insn);
+#endif
+    uint8_t b[4];
+    memcpy(b, &insn, sizeof(b));
+
+    /* one lookup by opcode and funct3, a short pattern list for the slots
+     * shared by several instructions. Fields and immediates are put
+     * together from the bytes, which avoids 32-bit shifts.
+     */
+    uint8_t op = OP_ILLEGAL;
+    if ((b[0] & 0b11) == 0b11) {
+        op = decode_slots[(uint8_t) (b[0] << 1 & 0xF8) | (b[1] >> 4 & 7)];
+        if (op & DECODE_SUB)
+            op = decode_sub(op & ~DECODE_SUB, b);
+    }
+
+    d->insn = insn;
+    d->op = op;
+    d->rd = (b[0] >> 7) | (uint8_t) ((b[1] & 0x0F) << 1);
+    d->rs1 = (b[1] >> 7) | (uint8_t) ((b[2] & 0x0F) << 1);
+    d->rs2 = (b[2] >> 4) | (uint8_t) ((b[3] & 0x01) << 4);
+    d->imm = decode_imm(decode_formats[op], b);
+#if SEMU_HAS(RVC)
+    if (compressed)
+        d->insn &= ~1;
+#endif
+}
+
+void decode_pseudo(decoded_insn_t *d)
+{
+    switch (d->op) {
+    case OP_ADDI:
+        if (!d->rd)
+            d->op = OP_NOP;
+        else if (!d->rs1)
+            d->op = OP_LI;
+        else if (!d->imm)
+            d->op = OP_MV;
+        break;
+    case OP_JAL:
+        if (!d->rd)
+            d->op = OP_J;
+        break;
+    case OP_JALR:
+        if (!d->rd && !d->imm)
+            d->op = OP_JR;
+        break;
+    case OP_BEQ:
+    case OP_BNE:
+        if (d->rs1 && d->rs2)
+            break;
+        d->rs1 |= d->rs2;
+        d->op = d->op == OP_BEQ ? OP_BEQZ : OP_BNEZ;
+        break;
+    default:
+        /* the register-only ops up to OP_AUIPC have no effect on x0 */
+        if (!d->rd && d->op != OP_ILLEGAL && d->op <= OP_AUIPC)
+            d->op = OP_NOP;
+        break;
+    }
+}
+
+void decode_fuse(decoded_insn_t *d, uint32_t next)
+{
+    decoded_insn_t n;
+
+    if (d->op != OP_LUI && d->op != OP_AUIPC && d->op != OP_SLLI)
+        return;
+    /* fused_next() steps over a 32-bit second instruction only */
+    if (decode_len(d) != 4 || (next & 0b11) != 0b11)
+        return;
+    decode_insn(&n, next);
+    /* the second instruction works on the result of the first */
+    if (!d->rd || n.rs1 != d->rd)
+        return;
+
+    switch (d->op) {
+    case OP_LUI:
+        if (n.op == OP_ADDI && n.rd == d->rd) {
+            d->op = OP_LUI_ADDI;
+            d->imm += n.imm;
+        }
+        break;
+    case OP_AUIPC:
+        if (n.op == OP_JALR ||
+            (n.op == OP_LOAD && decode_func3(next) == RV_MEM_LW)) {
+            d->op = n.op == OP_JALR ? OP_AUIPC_JALR : OP_AUIPC_LW;
+            d->rs2 = n.rd;
+            d->imm += n.imm;
+        }
+        break;
+    case OP_SLLI:
+        if (n.op == OP_SRLI && n.rd == d->rd && n.imm == d->imm) {
+            d->op = OP_SLLI_SRLI;
+            d->imm = UINT32_MAX >> d->imm;
+        }
+        break;
+    }
+}
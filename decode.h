@@ -0,0 +1,244 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Instruction decoding */
+
+/* clang-format off */
+/* instruction decode masks */
+enum {
+    //               ....xxxx....xxxx....xxxx....xxxx
+    FR_RD        = 0b00000000000000000000111110000000,
+    FR_FUNCT3    = 0b00000000000000000111000000000000,
+    FR_RS1       = 0b00000000000011111000000000000000,
+    FR_RS2       = 0b00000001111100000000000000000000,
+    //               ....xxxx....xxxx....xxxx....xxxx
+    FI_IMM_11_0  = 0b11111111111100000000000000000000, // I-type
+    //               ....xxxx....xxxx....xxxx....xxxx
+    FS_IMM_4_0   = 0b00000000000000000000111110000000, // S-type
+    FS_IMM_11_5  = 0b11111110000000000000000000000000,
+    //               ....xxxx....xxxx....xxxx....xxxx
+    FB_IMM_11    = 0b00000000000000000000000010000000, // B-type
+    FB_IMM_4_1   = 0b00000000000000000000111100000000,
+    FB_IMM_10_5  = 0b01111110000000000000000000000000,
+    FB_IMM_12    = 0b10000000000000000000000000000000,
+    //               ....xxxx....xxxx....xxxx....xxxx
+    FU_IMM_31_12 = 0b11111111111111111111000000000000, // U-type
+    //               ....xxxx....xxxx....xxxx....xxxx
+    FJ_IMM_19_12 = 0b00000000000011111111000000000000, // J-type
+    FJ_IMM_11    = 0b00000000000100000000000000000000,
+    FJ_IMM_10_1  = 0b01111111111000000000000000000000,
+    FJ_IMM_20    = 0b10000000000000000000000000000000,
+    //               ....xxxx....xxxx....xxxx....xxxx
+};
+/* clang-format on */
+
+/* decode U-type instruction immediate */
+static inline uint32_t decode_u(uint32_t insn)
+{
+    return insn & FU_IMM_31_12;
+}
+
+/* decode I-type instruction immediate */
+static inline uint32_t decode_i(uint32_t insn)
+{
+    return ((int32_t) (insn & FI_IMM_11_0)) >> 20;
+}
+
+static inline uint32_t decode_j(uint32_t insn)
+{
+    uint32_t dst = 0;
+    dst |= (insn & FJ_IMM_20);
+    dst |= (insn & FJ_IMM_19_12) << 11;
+    dst |= (insn & FJ_IMM_11) << 2;
+    dst |= (insn & FJ_IMM_10_1) >> 9;
+    /* NOTE: shifted to 2nd least significant bit */
+    return ((int32_t) dst) >> 11;
+}
+
+/* decode B-type instruction immediate */
+static inline uint32_t decode_b(uint32_t insn)
+{
+    uint32_t dst = 0;
+    dst |= (insn & FB_IMM_12);
+    dst |= (insn & FB_IMM_11) << 23;
+    dst |= (insn & FB_IMM_10_5) >> 1;
+    dst |= (insn & FB_IMM_4_1) << 12;
+    /* NOTE: shifted to 2nd least significant bit */
+    return ((int32_t) dst) >> 19;
+}
+
+/* decode S-type instruction immediate */
+static inline uint32_t decode_s(uint32_t insn)
+{
+    uint32_t dst = 0;
+    dst |= (insn & FS_IMM_11_5);
+    dst |= (insn & FS_IMM_4_0) << 13;
+    return ((int32_t) dst) >> 20;
+}
+
+static inline uint16_t decode_i_unsigned(uint32_t insn)
+{
+    return insn >> 20;
+}
+
+/* decode rd field */
+static inline uint8_t decode_rd(uint32_t insn)
+{
+    return (insn & FR_RD) >> 7;
+}
+
+/* decode rs1 field */
+static inline uint8_t decode_rs1(uint32_t insn)
+{
+    return (insn & FR_RS1) >> 15;
+}
+
+/* decode rs2 field */
+static inline uint8_t decode_rs2(uint32_t insn)
+{
+    return (insn & FR_RS2) >> 20;
+}
+
+/* decoded funct3 field */
+static inline uint8_t decode_func3(uint32_t insn)
+{
+    uint8_t *t = (uint8_t*)(&insn);
+    //return (insn & FR_FUNCT3) >> 12;
+    return (t[1] >> 4)&7;
+}
+
+/* decoded funct5 field */
+static inline uint8_t decode_func5(uint32_t insn)
+{
+    return insn >> 27;
+}
+
+/* Predecoded instructions
+ *
+ * Splitting the register fields and reassembling the immediates out of the
+ * 32-bit instruction word takes hundreds of 6502 cycles per instruction,
+ * while kernel hot loops run the same few hundred instructions millions of
+ * times. Each instruction is therefore decoded once into a handler index,
+ * its register numbers and its sign-extended immediate.
+ */
+
+/* handler indices */
+enum {
+    OP_ILLEGAL,
+    /* RV32_OP_IMM */
+    OP_ADDI,
+    OP_SLTI,
+    OP_SLTIU,
+    OP_XORI,
+    OP_ORI,
+    OP_ANDI,
+    OP_SLLI,
+    OP_SRLI,
+    OP_SRAI,
+    /* RV32_OP */
+    OP_ADD,
+    OP_SUB,
+    OP_SLL,
+    OP_SLT,
+    OP_SLTU,
+    OP_XOR,
+    OP_SRL,
+    OP_SRA,
+    OP_OR,
+    OP_AND,
+    OP_MULDIV, /**< M extension, funct3 is taken from the raw word */
+    /* Zba and Zbb, only decoded with BITMANIP */
+    OP_SH1ADD,
+    OP_SH2ADD,
+    OP_SH3ADD,
+    OP_ANDN,
+    OP_ORN,
+    OP_XNOR,
+    OP_MIN,
+    OP_MINU,
+    OP_MAX,
+    OP_MAXU,
+    OP_ROL,
+    OP_ROR,
+    OP_RORI,
+    OP_CLZ,
+    OP_CTZ,
+    OP_CPOP,
+    OP_SEXT_B,
+    OP_SEXT_H,
+    OP_ZEXT_H,
+    OP_ORC_B,
+    OP_REV8,
+    /* jumps and branches */
+    OP_LUI,
+    OP_AUIPC,
+    OP_JAL,
+    OP_JALR,
+    OP_BEQ,
+    OP_BNE,
+    OP_BLT,
+    OP_BGE,
+    OP_BLTU,
+    OP_BGEU,
+    /* memory, width is taken from the raw word */
+    OP_LOAD,
+    OP_STORE,
+    OP_FENCE,
+    OP_FENCE_I,
+    OP_CBO_ZERO, /**< Zicboz, rs1 holds an address in the block */
+    OP_AMO,
+    OP_SYSTEM,
+    /* common pseudo-instruction forms, only set by decode_pseudo() */
+    OP_MV,   /**< addi rd, rs, 0 */
+    OP_LI,   /**< addi rd, x0, imm */
+    OP_NOP,  /**< any register-only instruction writing x0 */
+    OP_J,    /**< jal x0, offset */
+    OP_JR,   /**< jalr x0, rs, 0, which includes ret */
+    OP_BEQZ, /**< beq rs, x0, offset, rs is in rs1 */
+    OP_BNEZ, /**< bne rs, x0, offset, rs is in rs1 */
+    /* fused pairs, only set by decode_fuse(). insn is the first word, rs2
+     * the rd of the second instruction, imm is given for each.
+     */
+    OP_LUI_ADDI,   /**< rd = constant in imm */
+    OP_AUIPC_JALR, /**< target pc - current_pc in imm */
+    OP_AUIPC_LW,   /**< load address - current_pc in imm */
+    OP_SLLI_SRLI,  /**< rd = rs1 & imm, a zero-extension */
+};
+
+typedef struct {
+    uint32_t tag;  /**< physical address | 1, zero if the slot is empty */
+    uint32_t insn; /**< raw instruction word, see decode_insn() */
+    uint32_t imm;  /**< sign-extended immediate (shift amount for shifts) */
+    uint8_t op;    /**< handler index */
+    uint8_t rd, rs1, rs2;
+} decoded_insn_t;
+
+/* Decode insn into d, leaving d->tag alone. With RVC, a compressed
+ * instruction in the low halfword of insn is decoded as the 32-bit one it
+ * stands for, and d->insn is that word with bit 0 cleared.
+ */
+void decode_insn(decoded_insn_t *d, uint32_t insn);
+
+/* Length in bytes of the instruction d was decoded from */
+static inline uint8_t decode_len(const decoded_insn_t *d)
+{
+#if SEMU_HAS(RVC)
+    return d->insn & 1 ? 4 : 2;
+#else
+    (void)d;
+    return 4;
+#endif
+}
+
+/* Turn a decoded instruction of one of the common pseudo-instruction forms
+ * into its OP_MV ... OP_BNEZ fast path. Only the interpreter has those, the
+ * translators work on what decode_insn() returns.
+ */
+void decode_pseudo(decoded_insn_t *d);
+
+/* Fuse d with the instruction word next following it, if the two form one of
+ * the OP_LUI_ADDI ... OP_SLLI_SRLI pairs.
+ */
+void decode_fuse(decoded_insn_t *d, uint32_t next);
@@ -0,0 +1,264 @@
+/* Generated by tools/gendecode from decode.isa, do not edit */
+
+#pragma once
+
+#include <string.h>
+
+/* clang-format off */
+enum {
+    DECODE_R,
+    DECODE_I,
+    DECODE_SH,
+    DECODE_S,
+    DECODE_B,
+    DECODE_U,
+    DECODE_J,
+};
+
+#define DECODE_SUB 0x80
+
+typedef struct {
+    uint8_t mask[4], match[4]; /**< bytes of the word */
+    uint8_t op;
+} decode_pattern_t;
+
+/* by opcode[6:2] << 3 | funct3, the rest is OP_ILLEGAL */
+static const uint8_t decode_slots[256] = {
+    [0x00] = OP_LOAD, /* lb */
+    [0x01] = OP_LOAD, /* lh */
+    [0x02] = OP_LOAD, /* lw */
+    [0x04] = OP_LOAD, /* lbu */
+    [0x05] = OP_LOAD, /* lhu */
+    [0x18] = OP_FENCE, /* fence */
+    [0x19] = OP_FENCE_I, /* fence.i */
+    [0x1A] = DECODE_SUB | 0, /* cbo.zero */
+    [0x20] = OP_ADDI, /* addi */
+    [0x21] = DECODE_SUB | 2, /* slli clz ctz cpop sext.b sext.h */
+    [0x22] = OP_SLTI, /* slti */
+    [0x23] = OP_SLTIU, /* sltiu */
+    [0x24] = OP_XORI, /* xori */
+    [0x25] = DECODE_SUB | 9, /* srli srai rori orc.b rev8 */
+    [0x26] = OP_ORI, /* ori */
+    [0x27] = OP_ANDI, /* andi */
+    [0x28] = OP_AUIPC, /* auipc */
+    [0x29] = OP_AUIPC, /* auipc */
+    [0x2A] = OP_AUIPC, /* auipc */
+    [0x2B] = OP_AUIPC, /* auipc */
+    [0x2C] = OP_AUIPC, /* auipc */
+    [0x2D] = OP_AUIPC, /* auipc */
+    [0x2E] = OP_AUIPC, /* auipc */
+    [0x2F] = OP_AUIPC, /* auipc */
+    [0x40] = OP_STORE, /* sb */
+    [0x41] = OP_STORE, /* sh */
+    [0x42] = OP_STORE, /* sw */
+    [0x5A] = OP_AMO, /* amo.w */
+    [0x60] = DECODE_SUB | 15, /* add sub mul */
+    [0x61] = DECODE_SUB | 19, /* sll mulh rol */
+    [0x62] = DECODE_SUB | 23, /* slt mulhsu sh1add */
+    [0x63] = DECODE_SUB | 27, /* sltu mulhu */
+    [0x64] = DECODE_SUB | 30, /* xor div sh2add xnor min zext.h */
+    [0x65] = DECODE_SUB | 37, /* srl sra divu minu ror */
+    [0x66] = DECODE_SUB | 43, /* or rem sh3add orn max */
+    [0x67] = DECODE_SUB | 49, /* and remu andn maxu */
+    [0x68] = OP_LUI, /* lui */
+    [0x69] = OP_LUI, /* lui */
+    [0x6A] = OP_LUI, /* lui */
+    [0x6B] = OP_LUI, /* lui */
+    [0x6C] = OP_LUI, /* lui */
+    [0x6D] = OP_LUI, /* lui */
+    [0x6E] = OP_LUI, /* lui */
+    [0x6F] = OP_LUI, /* lui */
+    [0xC0] = OP_BEQ, /* beq */
+    [0xC1] = OP_BNE, /* bne */
+    [0xC4] = OP_BLT, /* blt */
+    [0xC5] = OP_BGE, /* bge */
+    [0xC6] = OP_BLTU, /* bltu */
+    [0xC7] = OP_BGEU, /* bgeu */
+    [0xC8] = OP_JALR, /* jalr */
+    [0xD8] = OP_JAL, /* jal */
+    [0xD9] = OP_JAL, /* jal */
+    [0xDA] = OP_JAL, /* jal */
+    [0xDB] = OP_JAL, /* jal */
+    [0xDC] = OP_JAL, /* jal */
+    [0xDD] = OP_JAL, /* jal */
+    [0xDE] = OP_JAL, /* jal */
+    [0xDF] = OP_JAL, /* jal */
+    [0xE0] = OP_SYSTEM, /* system */
+    [0xE1] = OP_SYSTEM, /* csrrw */
+    [0xE2] = OP_SYSTEM, /* csrrs */
+    [0xE3] = OP_SYSTEM, /* csrrc */
+    [0xE5] = OP_SYSTEM, /* csrrwi */
+    [0xE6] = OP_SYSTEM, /* csrrsi */
+    [0xE7] = OP_SYSTEM, /* csrrci */
+};
+
+static const decode_pattern_t decode_subs[54] = {
+    {{0x80, 0x0F, 0xF0, 0xFF}, {0x00, 0x00, 0x40, 0x00}, OP_CBO_ZERO},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_SLLI},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x00, 0x60}, SEMU_HAS(BITMANIP) ? OP_CLZ : OP_ILLEGAL},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x10, 0x60}, SEMU_HAS(BITMANIP) ? OP_CTZ : OP_ILLEGAL},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x20, 0x60}, SEMU_HAS(BITMANIP) ? OP_CPOP : OP_ILLEGAL},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x40, 0x60}, SEMU_HAS(BITMANIP) ? OP_SEXT_B : OP_ILLEGAL},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x50, 0x60}, SEMU_HAS(BITMANIP) ? OP_SEXT_H : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_SRLI},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x40}, OP_SRAI},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x60}, SEMU_HAS(BITMANIP) ? OP_RORI : OP_ILLEGAL},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x70, 0x28}, SEMU_HAS(BITMANIP) ? OP_ORC_B : OP_ILLEGAL},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x80, 0x69}, SEMU_HAS(BITMANIP) ? OP_REV8 : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_ADD},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x40}, OP_SUB},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_SLL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x60}, SEMU_HAS(BITMANIP) ? OP_ROL : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_SLT},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x20}, SEMU_HAS(BITMANIP) ? OP_SH1ADD : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_SLTU},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_XOR},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x20}, SEMU_HAS(BITMANIP) ? OP_SH2ADD : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x40}, SEMU_HAS(BITMANIP) ? OP_XNOR : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x0A}, SEMU_HAS(BITMANIP) ? OP_MIN : OP_ILLEGAL},
+    {{0x00, 0x00, 0xF0, 0xFF}, {0x00, 0x00, 0x00, 0x08}, SEMU_HAS(BITMANIP) ? OP_ZEXT_H : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_SRL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x40}, OP_SRA},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x0A}, SEMU_HAS(BITMANIP) ? OP_MINU : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x60}, SEMU_HAS(BITMANIP) ? OP_ROR : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_OR},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x20}, SEMU_HAS(BITMANIP) ? OP_SH3ADD : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x40}, SEMU_HAS(BITMANIP) ? OP_ORN : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x0A}, SEMU_HAS(BITMANIP) ? OP_MAX : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x00}, OP_AND},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x02}, OP_MULDIV},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x40}, SEMU_HAS(BITMANIP) ? OP_ANDN : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0xFE}, {0x00, 0x00, 0x00, 0x0A}, SEMU_HAS(BITMANIP) ? OP_MAXU : OP_ILLEGAL},
+    {{0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00}, OP_ILLEGAL},
+};
+
+static const uint8_t decode_formats[] = {
+    [OP_LUI] = DECODE_U,
+    [OP_AUIPC] = DECODE_U,
+    [OP_JAL] = DECODE_J,
+    [OP_JALR] = DECODE_I,
+    [OP_BEQ] = DECODE_B,
+    [OP_BNE] = DECODE_B,
+    [OP_BLT] = DECODE_B,
+    [OP_BGE] = DECODE_B,
+    [OP_BLTU] = DECODE_B,
+    [OP_BGEU] = DECODE_B,
+    [OP_LOAD] = DECODE_I,
+    [OP_STORE] = DECODE_S,
+    [OP_ADDI] = DECODE_I,
+    [OP_SLTI] = DECODE_I,
+    [OP_SLTIU] = DECODE_I,
+    [OP_XORI] = DECODE_I,
+    [OP_ORI] = DECODE_I,
+    [OP_ANDI] = DECODE_I,
+    [OP_SLLI] = DECODE_SH,
+    [OP_SRLI] = DECODE_SH,
+    [OP_SRAI] = DECODE_SH,
+    [OP_ADD] = DECODE_R,
+    [OP_SUB] = DECODE_R,
+    [OP_SLL] = DECODE_R,
+    [OP_SLT] = DECODE_R,
+    [OP_SLTU] = DECODE_R,
+    [OP_XOR] = DECODE_R,
+    [OP_SRL] = DECODE_R,
+    [OP_SRA] = DECODE_R,
+    [OP_OR] = DECODE_R,
+    [OP_AND] = DECODE_R,
+    [OP_FENCE] = DECODE_R,
+    [OP_SYSTEM] = DECODE_R,
+    [OP_FENCE_I] = DECODE_R,
+    [OP_CBO_ZERO] = DECODE_R,
+    [OP_MULDIV] = DECODE_R,
+    [OP_AMO] = DECODE_R,
+    [OP_SH1ADD] = DECODE_R,
+    [OP_SH2ADD] = DECODE_R,
+    [OP_SH3ADD] = DECODE_R,
+    [OP_ANDN] = DECODE_R,
+    [OP_ORN] = DECODE_R,
+    [OP_XNOR] = DECODE_R,
+    [OP_MIN] = DECODE_R,
+    [OP_MINU] = DECODE_R,
+    [OP_MAX] = DECODE_R,
+    [OP_MAXU] = DECODE_R,
+    [OP_ROL] = DECODE_R,
+    [OP_ROR] = DECODE_R,
+    [OP_RORI] = DECODE_SH,
+    [OP_CLZ] = DECODE_R,
+    [OP_CTZ] = DECODE_R,
+    [OP_CPOP] = DECODE_R,
+    [OP_SEXT_B] = DECODE_R,
+    [OP_SEXT_H] = DECODE_R,
+    [OP_ZEXT_H] = DECODE_R,
+    [OP_ORC_B] = DECODE_R,
+    [OP_REV8] = DECODE_R,
+};
+
+/* The immediate of format from the instruction bytes b[] */
+static inline uint32_t decode_imm(uint8_t format, const uint8_t *b)
+{
+    const uint8_t sign = b[3] & 0x80 ? 0xFF : 0;
+    uint8_t imm[4];
+
+    switch (format) {
+    case DECODE_I:
+        imm[0] = (b[2] >> 4) | (uint8_t) (b[3] << 4);
+        imm[1] = (b[3] >> 4 & 0x07) | (sign & 0xF8);
+        imm[2] = sign;
+        imm[3] = sign;
+        break;
+    case DECODE_SH:
+        imm[0] = (b[2] >> 4) | (uint8_t) ((b[3] & 0x01) << 4);
+        imm[1] = 0;
+        imm[2] = 0;
+        imm[3] = 0;
+        break;
+    case DECODE_S:
+        imm[0] = (b[0] >> 7) | (uint8_t) ((b[1] & 0x0F) << 1) | (uint8_t) ((b[3] & 0x0E) << 4);
+        imm[1] = (b[3] >> 4 & 0x07) | (sign & 0xF8);
+        imm[2] = sign;
+        imm[3] = sign;
+        break;
+    case DECODE_B:
+        imm[0] = (uint8_t) ((b[1] & 0x0F) << 1) | (uint8_t) ((b[3] & 0x0E) << 4);
+        imm[1] = (b[0] >> 4 & 0x08) | (b[3] >> 4 & 0x07) | (sign & 0xF0);
+        imm[2] = sign;
+        imm[3] = sign;
+        break;
+    case DECODE_U:
+        imm[0] = 0;
+        imm[1] = (b[1] & 0xF0);
+        imm[2] = b[2];
+        imm[3] = b[3];
+        break;
+    case DECODE_J:
+        imm[0] = (b[2] >> 4 & 0x0E) | (uint8_t) (b[3] << 4);
+        imm[1] = (b[1] & 0xF0) | (b[2] >> 1 & 0x08) | (b[3] >> 4 & 0x07);
+        imm[2] = (b[2] & 0x0F) | (sign & 0xF0);
+        imm[3] = sign;
+        break;
+    default:
+        return 0;
+    }
+
+    uint32_t x;
+    memcpy(&x, imm, sizeof(x));
+    return x;
+}
+/* clang-format on */
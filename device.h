@@ -22,6 +22,16 @@ void ram_write(vm_t *core,
 	       const uint8_t width,
 	       const uint32_t value);
 
+void ram_zero(vm_t *core, uint32_t *mem, const uint32_t addr, uint16_t len);
+
+#if SEMU_HAS(MISALIGNED)
+/* misaligned loads and stores made, which raised an exception without
+ * MISALIGNED. ram_read() and ram_write() count those within a page, the
+ * interpreter those it splits at a page boundary.
+ */
+extern uint32_t ram_misaligned;
+#endif
+
 /* PLIC */
 
 typedef struct {
@@ -187,4 +197,5 @@ typedef struct {
     virtio_blk_state_t vblk;
 #endif
     uint32_t timer_lo, timer_hi;
+    uint32_t idle_lo, idle_hi; /**< instructions skipped by WFI */
 } emu_state_t;
@@ -12,5 +12,70 @@
 #define SEMU_FEATUREVIRTIONET 1
 #endif
 
+/* RV32C compressed instructions */
+#ifndef SEMU_FEATURE_RVC
+#define SEMU_FEATURE_RVC 1
+#endif
+
+/* Zba and Zbb bit manipulation instructions */
+#ifndef SEMU_FEATURE_BITMANIP
+#define SEMU_FEATURE_BITMANIP 1
+#endif
+
+/* misaligned loads and stores done in place instead of trapping */
+#ifndef SEMU_FEATURE_MISALIGNED
+#define SEMU_FEATURE_MISALIGNED 1
+#endif
+
+/* REU word cache of reu.c writing dirty lines back instead of every store */
+#ifndef SEMU_FEATURE_REU_WRITEBACK
+#define SEMU_FEATURE_REU_WRITEBACK 1
+#endif
+
+/* memory bus of bus.h bound at compile time instead of the vm_t callbacks */
+#ifndef SEMU_FEATURE_STATIC_BUS
+#define SEMU_FEATURE_STATIC_BUS 1
+#endif
+
+/* common instruction pairs run as one interpreter step */
+#ifndef SEMU_FEATURE_FUSE
+#define SEMU_FEATURE_FUSE 1
+#endif
+
+/* predecoded instruction cache */
+#ifndef SEMU_FEATURE_DECODE_CACHE
+#define SEMU_FEATURE_DECODE_CACHE 1
+#endif
+
+/* translation of hot basic blocks into 6502 code */
+#ifndef SEMU_FEATURE_JIT
+#define SEMU_FEATURE_JIT 0
+#endif
+
+/* ahead-of-time translated kernel text in the REU */
+#ifndef SEMU_FEATURE_AOT
+#define SEMU_FEATURE_AOT 0
+#endif
+
+/* guest registers stored as four byte planes instead of 32-bit words */
+#ifndef SEMU_FEATURE_REG_PLANES
+#define SEMU_FEATURE_REG_PLANES 0
+#endif
+
+/* hand-written 6502 handlers for the most frequent instructions */
+#ifndef SEMU_FEATURE_ASM_CORE
+#define SEMU_FEATURE_ASM_CORE 0
+#endif
+
+/* exceptions unwind to the interpreter loop instead of being polled for */
+#ifndef SEMU_FEATURE_UNWIND
+#define SEMU_FEATURE_UNWIND 0
+#endif
+
+/* hit counters for the interpreter fast paths, shown in the debug menu */
+#ifndef SEMU_FEATURE_INSN_STATS
+#define SEMU_FEATURE_INSN_STATS 0
+#endif
+
 /* Feature test macro */
 #define SEMU_HAS(x) SEMU_FEATURE_##x
@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "device.h"
+#include "jit.h"
+#include "jit_emit.h"
+#include "reu.h"
+#include "riscv.h"
+#include "riscv_private.h"
+
+#if SEMU_HAS(JIT)
+
+#ifndef JIT_CODE_SIZE
+#define JIT_CODE_SIZE 6144 /* bytes of native code */
+#endif
+
+#ifndef JIT_BLOCKS
+#define JIT_BLOCKS 64 /* must be a power of two */
+#endif
+
+#ifndef JIT_HOT
+#define JIT_HOT 8 /* entries into a block before it gets translated */
+#endif
+
+#define JIT_MAX_LEN 32 /* guest instructions per block */
+
+#ifdef JIT_HOST
+/* Built into tools/jitdiff.c, which runs the code in a 6502 simulator with
+ * the register file at JIT_HOST in its memory.
+ */
+uint8_t jit_host_call(vm_t *vm, const uint8_t *code);
+#define JIT_CALL(vm, code) jit_host_call(vm, code)
+#define JIT_REGS(vm) ((uint16_t) JIT_HOST)
+#else
+#define JIT_CALL(vm, code) ((jit_code_t) (code))()
+#define JIT_REGS(vm) ((uint16_t) (uintptr_t) (vm)->x_regs)
+#endif
+
+typedef struct jit_block jit_block_t;
+struct jit_block {
+    uint32_t tag;         /**< physical address | 1, zero if the slot is empty */
+    uint32_t vpc;         /**< virtual address the block was entered at */
+    uint32_t exit_pc[2];  /**< next pc: fall through, branch taken */
+    jit_block_t *link[2]; /**< block at exit_pc[] in the same page, if known */
+    uint8_t *code;        /**< native code, NULL if not translated */
+    uint8_t len;          /**< guest instructions */
+    uint8_t hits;         /**< entries counted, translated at JIT_HOT */
+};
+
+uint8_t jit_pages[RAM_SIZE / RV_PAGE_SIZE / 8];
+
+static jit_block_t jit_blocks[JIT_BLOCKS];
+static uint8_t jit_code[JIT_CODE_SIZE];
+static uint8_t *jit_code_pos = jit_code;
+
+/* Block cache */
+
+void jit_flush(void)
+{
+    memset(jit_blocks, 0, sizeof(jit_blocks));
+    memset(jit_pages, 0, sizeof(jit_pages));
+    jit_code_pos = jit_code;
+}
+
+void jit_unlink(void)
+{
+    for (uint8_t i = 0; i < JIT_BLOCKS; i++)
+        jit_blocks[i].link[0] = jit_blocks[i].link[1] = NULL;
+}
+
+void jit_invalidate_page(uint16_t page)
+{
+    for (uint8_t i = 0; i < JIT_BLOCKS; i++) {
+        if ((jit_blocks[i].tag >> RV_PAGE_SHIFT) == page) {
+            jit_blocks[i].tag = 0;
+            jit_blocks[i].code = NULL;
+        }
+    }
+    jit_pages[page >> 3] &= ~(1 << (page & 7));
+}
+
+/* Translate the block at vm->pc, which is at the physical address addr */
+static void jit_translate(vm_t *vm, jit_block_t *b, uint32_t addr)
+{
+    const uint16_t page = addr >> RV_PAGE_SHIFT;
+    jit_emit_t e = {
+        .pos = jit_code_pos,
+        .end = jit_code + JIT_CODE_SIZE,
+        .regs = JIT_REGS(vm),
+        .planes = SEMU_HAS(REG_PLANES),
+    };
+
+    b->len = jit_emit_block(&e, vm->pc, addr, JIT_MAX_LEN, fetchword_reu);
+    b->link[0] = b->link[1] = NULL;
+    /* stores into the page have to drop even a failed attempt */
+    jit_pages[page >> 3] |= 1 << (page & 7);
+    if (unlikely(e.full)) {
+        jit_flush();
+        return;
+    }
+    if (b->len) {
+        b->code = jit_code_pos;
+        b->exit_pc[0] = e.exit_pc[0];
+        b->exit_pc[1] = e.exit_pc[1];
+        jit_code_pos = e.pos;
+    }
+}
+
+static jit_block_t *jit_lookup(vm_t *vm, uint32_t addr)
+{
+    jit_block_t *b = &jit_blocks[(addr >> 2) & (JIT_BLOCKS - 1)];
+    if (unlikely(b->tag != (addr | 1) || b->vpc != vm->pc)) {
+        if (addr >= RAM_SIZE)
+            return NULL;
+        b->tag = addr | 1;
+        b->vpc = vm->pc;
+        b->code = NULL;
+        b->hits = 0;
+    }
+    if (unlikely(b->hits < JIT_HOT) && ++b->hits == JIT_HOT)
+        jit_translate(vm, b, addr);
+    return b->code ? b : NULL;
+}
+
+/* The block following b, which was left through exit */
+static jit_block_t *jit_follow(vm_t *vm, jit_block_t *b, uint8_t exit)
+{
+    jit_block_t *next = b->link[exit];
+    if (likely(next && next->code && next->vpc == vm->pc))
+        return next;
+    /* only the own page is known to be mapped and executable */
+    if ((vm->pc ^ b->vpc) & ~MASK(RV_PAGE_SHIFT))
+        return NULL;
+    next = jit_lookup(vm, (b->tag & ~MASK(RV_PAGE_SHIFT)) |
+                              (vm->pc & MASK(RV_PAGE_SHIFT)));
+    b->link[exit] = next;
+    return next;
+}
+
+uint16_t jit_run(vm_t *vm, uint32_t addr, uint16_t budget)
+{
+    jit_block_t *b = jit_lookup(vm, addr);
+    uint16_t steps = 0;
+
+    while (b && b->len <= budget) {
+        const uint8_t exit = JIT_CALL(vm, b->code);
+        vm->current_pc = b->vpc + 4 * (uint32_t) (b->len - 1);
+        vm->pc = b->exit_pc[exit];
+        budget -= b->len;
+        steps += b->len;
+        b = jit_follow(vm, b, exit);
+    }
+    return steps;
+}
+
+#endif
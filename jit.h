@@ -0,0 +1,61 @@
+#pragma once
+
+#include "device.h"
+#include "riscv.h"
+#include "riscv_private.h"
+
+/* Translation of hot guest basic blocks into native 6502 code
+ *
+ * A block is a run of register-only instructions (ALU, LUI, AUIPC) within
+ * one guest page, ended by a conditional branch or JAL, or right before the
+ * first instruction the translator does not handle. Its native code returns
+ * in A which of the two exits was taken. Loads, stores, CSR accesses and
+ * everything else that can trap or touch MMIO stays with the interpreter.
+ */
+
+#if SEMU_HAS(JIT)
+/* Run translated blocks starting at vm->pc, whose guest physical address is
+ * addr, for at most budget instructions. Blocks only run as a whole and are
+ * chained within the page without going back to the interpreter. Returns
+ * the number of guest instructions run, zero if there is no translation for
+ * addr (yet). The caller counts them into vm->insn_count.
+ *
+ * Pending interrupts have to be taken before, nothing a block does can
+ * change them.
+ */
+uint16_t jit_run(vm_t *vm, uint32_t addr, uint16_t budget);
+
+/* Drop all translations */
+void jit_flush(void);
+
+/* Drop the links between blocks, which are only valid as long as the address
+ * translation does not change.
+ */
+void jit_unlink(void);
+
+/* one bit per guest physical page with translations */
+extern uint8_t jit_pages[RAM_SIZE / RV_PAGE_SIZE / 8];
+
+void jit_invalidate_page(uint16_t page);
+
+/* Drop the translations of the page a store to the physical address addr
+ * hits.
+ */
+static inline void jit_snoop(uint32_t addr)
+{
+    const uint32_t page = addr >> RV_PAGE_SHIFT;
+    if (unlikely(page < RAM_SIZE / RV_PAGE_SIZE &&
+                 (jit_pages[page >> 3] & (1 << (page & 7)))))
+        jit_invalidate_page(page);
+}
+#else
+static inline uint16_t jit_run(vm_t *vm UNUSED,
+                               uint32_t addr UNUSED,
+                               uint16_t budget UNUSED)
+{
+    return 0;
+}
+static inline void jit_flush(void) {}
+static inline void jit_unlink(void) {}
+static inline void jit_snoop(uint32_t addr UNUSED) {}
+#endif
@@ -0,0 +1,391 @@
+#include <stdint.h>
+
+#include "decode.h"
+#include "jit_emit.h"
+#include "riscv_private.h"
+
+/* 6502 opcodes, the immediate form of the ALU ones is at abs - 4 */
+enum {
+    ORA_ABS = 0x0D,
+    AND_ABS = 0x2D,
+    EOR_ABS = 0x4D,
+    ADC_ABS = 0x6D,
+    STA_ABS = 0x8D,
+    LDA_ABS = 0xAD,
+    CMP_ABS = 0xCD,
+    SBC_ABS = 0xED,
+    STX_ABS = 0x8E,
+    ASL_ABS = 0x0E,
+    ROL_ABS = 0x2E,
+    LSR_ABS = 0x4E,
+    ROR_ABS = 0x6E,
+    ASL_A = 0x0A,
+    ROL_A = 0x2A,
+    LDA_IMM = 0xA9,
+    LDX_IMM = 0xA2,
+    CMP_IMM = 0xC9,
+    EOR_IMM = 0x49,
+    CLC = 0x18,
+    SEC = 0x38,
+    DEX = 0xCA,
+    RTS = 0x60,
+    BPL = 0x10,
+    BVC = 0x50,
+    BNE = 0xD0,
+};
+
+#define SRC_IMM 32 /* source operand is the immediate, not a register */
+
+static jit_emit_t *out;
+
+static void emit(uint8_t byte)
+{
+    if (unlikely(out->pos >= out->end)) {
+        out->full = true;
+        return;
+    }
+    *out->pos++ = byte;
+}
+
+/* address of byte k of guest register r */
+static uint16_t reg(uint8_t r, uint8_t k)
+{
+    if (out->planes)
+        return out->regs + 32 * k + r;
+    return out->regs + 4 * r + k;
+}
+
+static void emit_abs(uint8_t op, uint16_t addr)
+{
+    emit(op);
+    emit(addr & 0xFF);
+    emit(addr >> 8);
+}
+
+static void emit_imm(uint8_t op, uint8_t value)
+{
+    emit(op);
+    emit(value);
+}
+
+/* Relative branch to a label emitted later, returns the offset to patch */
+static uint8_t *emit_fwd(uint8_t op)
+{
+    emit(op);
+    emit(0);
+    return out->pos - 1;
+}
+
+static void patch_fwd(uint8_t *at)
+{
+    if (likely(!out->full))
+        *at = out->pos - at - 1;
+}
+
+/* ALU op_abs on byte k of register r, or of imm if r is SRC_IMM */
+static void emit_src(uint8_t op_abs, uint8_t r, uint32_t imm, uint8_t k)
+{
+    if (r == SRC_IMM || r == 0)
+        emit_imm(op_abs - 4, r ? imm >> (8 * k) : 0);
+    else
+        emit_abs(op_abs, reg(r, k));
+}
+
+static void emit_const(uint8_t rd, uint32_t value)
+{
+    for (uint8_t k = 0; k < 4; k++) {
+        if (!k || (uint8_t) (value >> (8 * k)) != (uint8_t) (value >> (8 * k - 8)))
+            emit_imm(LDA_IMM, value >> (8 * k));
+        emit_abs(STA_ABS, reg(rd, k));
+    }
+}
+
+/* rd = a op b byte by byte, after setting up the carry with pre if not 0.
+ * Byte k of rd is only written after byte k of both sources is read.
+ */
+static void emit_bytewise(uint8_t op_abs,
+                          uint8_t pre,
+                          uint8_t rd,
+                          uint8_t a,
+                          uint8_t b,
+                          uint32_t imm)
+{
+    if (pre)
+        emit(pre);
+    for (uint8_t k = 0; k < 4; k++) {
+        emit_src(LDA_ABS, a, 0, k);
+        emit_src(op_abs, b, imm, k);
+        emit_abs(STA_ABS, reg(rd, k));
+    }
+}
+
+/* A = (a < b) ? 1 : 0 */
+static void emit_less(uint8_t a, uint8_t b, uint32_t imm, bool sign)
+{
+    emit(SEC);
+    for (uint8_t k = 0; k < 4; k++) {
+        emit_src(LDA_ABS, a, 0, k);
+        emit_src(SBC_ABS, b, imm, k);
+    }
+    if (sign) {
+        /* less is N ^ V of the subtraction */
+        emit_imm(BVC, 2);
+        emit_imm(EOR_IMM, 0x80);
+        emit(ASL_A);
+        emit_imm(LDA_IMM, 0);
+        emit(ROL_A);
+    } else {
+        /* less is the borrow */
+        emit_imm(LDA_IMM, 0);
+        emit(ROL_A);
+        emit_imm(EOR_IMM, 1);
+    }
+}
+
+/* A = (a == b) ? 1 : 0 */
+static void emit_equal(uint8_t a, uint8_t b)
+{
+    if (!a || !b) {
+        const uint8_t r = a | b;
+        for (uint8_t k = 0; k < 4; k++)
+            emit_src(k ? ORA_ABS : LDA_ABS, r, 0, k);
+        emit_imm(CMP_IMM, 1); /* carry set if not zero */
+        emit_imm(LDA_IMM, 0);
+        emit(ROL_A);
+        emit_imm(EOR_IMM, 1);
+        return;
+    }
+    uint8_t *ne[4];
+    for (uint8_t k = 0; k < 4; k++) {
+        emit_abs(LDA_ABS, reg(a, k));
+        emit_abs(CMP_ABS, reg(b, k));
+        ne[k] = emit_fwd(BNE);
+    }
+    emit_imm(LDA_IMM, 1);
+    emit_imm(BNE, 2);
+    for (uint8_t k = 0; k < 4; k++)
+        patch_fwd(ne[k]);
+    emit_imm(LDA_IMM, 0);
+}
+
+/* Shift rd = rs by sh bits, left, right or arithmetic right. Whole bytes are
+ * moved first, the remaining bits are shifted through the carry.
+ */
+static void emit_shift(uint8_t op, uint8_t rd, uint8_t rs, uint8_t sh)
+{
+    const uint8_t q = sh >> 3, bits = sh & 7;
+    uint8_t first, last;
+
+    if (op == OP_SRAI) {
+        /* X = sign extension byte */
+        emit_imm(LDX_IMM, 0);
+        emit_abs(LDA_ABS, reg(rs, 3));
+        emit_imm(BPL, 1);
+        emit(DEX);
+    }
+    if (q || rd != rs) {
+        for (uint8_t i = 0; i < 4; i++) {
+            /* left shifts move bytes up, so copy from the top */
+            const uint8_t k = op == OP_SLLI ? 3 - i : i;
+            const int8_t from = op == OP_SLLI ? k - q : k + q;
+            if (from >= 0 && from <= 3) {
+                emit_abs(LDA_ABS, reg(rs, from));
+                emit_abs(STA_ABS, reg(rd, k));
+            } else if (op == OP_SRAI) {
+                emit_abs(STX_ABS, reg(rd, k));
+            } else {
+                emit_imm(LDA_IMM, 0);
+                emit_abs(STA_ABS, reg(rd, k));
+            }
+        }
+    }
+    if (!bits)
+        return;
+
+    /* bytes that are not all shifted in zeros or sign */
+    first = op == OP_SLLI ? q : 0;
+    last = op == OP_SLLI ? 3 : 3 - q;
+    if (op == OP_SRAI)
+        last = 3;
+
+    uint8_t *loop = out->pos;
+    if (bits > 2) {
+        emit_imm(LDX_IMM, bits);
+        loop = out->pos;
+    }
+    for (uint8_t n = bits > 2 ? 1 : bits; n; n--) {
+        if (op == OP_SLLI) {
+            for (uint8_t k = first; k <= last; k++)
+                emit_abs(k == first ? ASL_ABS : ROL_ABS, reg(rd, k));
+        } else {
+            if (op == OP_SRAI) {
+                emit_abs(LDA_ABS, reg(rd, 3));
+                emit(ASL_A);
+            }
+            for (int8_t k = last; k >= (int8_t) first; k--)
+                emit_abs(k == last && op == OP_SRLI ? LSR_ABS : ROR_ABS,
+                         reg(rd, k));
+        }
+    }
+    if (bits > 2) {
+        emit(DEX);
+        emit_imm(BNE, loop - out->pos - 2);
+    }
+}
+
+enum {
+    EMIT_NONE, /**< not translatable, ends the block before it */
+    EMIT_NEXT, /**< translated, the block goes on */
+    EMIT_EXIT, /**< translated, ends the block with A = exit */
+};
+
+/* Emit d at pc */
+static uint8_t emit_insn(const decoded_insn_t *d, uint32_t pc)
+{
+    const uint8_t rd = d->rd;
+    const uint32_t target = pc + d->imm;
+
+    switch (d->op) {
+    case OP_ADDI:
+    case OP_XORI:
+    case OP_ORI:
+        if (!rd)
+            break;
+        if (!d->rs1) {
+            emit_const(rd, d->imm);
+            break;
+        }
+        if (d->op == OP_ADDI)
+            emit_bytewise(ADC_ABS, CLC, rd, d->rs1, SRC_IMM, d->imm);
+        else
+            emit_bytewise(d->op == OP_XORI ? EOR_ABS : ORA_ABS, 0, rd, d->rs1,
+                          SRC_IMM, d->imm);
+        break;
+    case OP_ANDI:
+        if (rd)
+            emit_bytewise(AND_ABS, 0, rd, d->rs1, SRC_IMM, d->imm);
+        break;
+    case OP_ADD:
+        if (rd)
+            emit_bytewise(ADC_ABS, CLC, rd, d->rs1, d->rs2, 0);
+        break;
+    case OP_SUB:
+        if (rd)
+            emit_bytewise(SBC_ABS, SEC, rd, d->rs1, d->rs2, 0);
+        break;
+    case OP_XOR:
+        if (rd)
+            emit_bytewise(EOR_ABS, 0, rd, d->rs1, d->rs2, 0);
+        break;
+    case OP_OR:
+        if (rd)
+            emit_bytewise(ORA_ABS, 0, rd, d->rs1, d->rs2, 0);
+        break;
+    case OP_AND:
+        if (rd)
+            emit_bytewise(AND_ABS, 0, rd, d->rs1, d->rs2, 0);
+        break;
+    case OP_SLTI:
+    case OP_SLTIU:
+    case OP_SLT:
+    case OP_SLTU:
+        if (!rd)
+            break;
+        if (d->op == OP_SLTI || d->op == OP_SLTIU)
+            emit_less(d->rs1, SRC_IMM, d->imm, d->op == OP_SLTI);
+        else
+            emit_less(d->rs1, d->rs2, 0, d->op == OP_SLT);
+        emit_abs(STA_ABS, reg(rd, 0));
+        emit_imm(LDA_IMM, 0);
+        for (uint8_t k = 1; k < 4; k++)
+            emit_abs(STA_ABS, reg(rd, k));
+        break;
+    case OP_SLLI:
+    case OP_SRLI:
+    case OP_SRAI:
+        if (rd)
+            emit_shift(d->op, rd, d->rs1, d->imm);
+        break;
+    case OP_LUI:
+        if (rd)
+            emit_const(rd, d->imm);
+        break;
+    case OP_AUIPC:
+        if (rd)
+            emit_const(rd, target);
+        break;
+    case OP_JAL:
+        if (target & 0b11)
+            return EMIT_NONE;
+        if (rd)
+            emit_const(rd, pc + 4);
+        emit_imm(LDA_IMM, JIT_EXIT_TAKEN);
+        emit(RTS);
+        out->exit_pc[JIT_EXIT_NEXT] = out->exit_pc[JIT_EXIT_TAKEN] = target;
+        return EMIT_EXIT;
+    case OP_BEQ:
+    case OP_BNE:
+    case OP_BLT:
+    case OP_BGE:
+    case OP_BLTU:
+    case OP_BGEU:
+        if (target & 0b11)
+            return EMIT_NONE;
+        if (d->op == OP_BEQ || d->op == OP_BNE)
+            emit_equal(d->rs1, d->rs2);
+        else
+            emit_less(d->rs1, d->rs2, 0, d->op == OP_BLT || d->op == OP_BGE);
+        if (d->op == OP_BNE || d->op == OP_BGE || d->op == OP_BGEU)
+            emit_imm(EOR_IMM, 1);
+        emit(RTS);
+        out->exit_pc[JIT_EXIT_NEXT] = pc + 4;
+        out->exit_pc[JIT_EXIT_TAKEN] = target;
+        return EMIT_EXIT;
+    default:
+        return EMIT_NONE;
+    }
+    return EMIT_NEXT;
+}
+
+uint8_t jit_emit_block(jit_emit_t *e,
+                       uint32_t pc,
+                       uint32_t addr,
+                       uint8_t max_len,
+                       uint32_t (*fetch)(uint32_t addr))
+{
+    uint8_t *const code = e->pos;
+    uint8_t len = 0;
+
+    out = e;
+    for (;;) {
+        decoded_insn_t d;
+        /* blocks are made of whole words, compressed instructions and
+         * halfword-aligned entries are left to the interpreter
+         */
+        if (addr & 0b11)
+            break;
+        const uint32_t insn = fetch(addr);
+        if ((insn & 0b11) != 0b11)
+            break;
+        decode_insn(&d, insn);
+        const uint8_t emitted = emit_insn(&d, pc);
+        if (emitted == EMIT_NONE)
+            break;
+        len++;
+        if (emitted == EMIT_EXIT)
+            return len;
+        pc += 4;
+        addr += 4;
+        if (len == max_len || !(addr & MASK(RV_PAGE_SHIFT)))
+            break;
+    }
+    if (!len) {
+        e->pos = code;
+        return 0;
+    }
+    /* fall through to the interpreter at pc */
+    emit_imm(LDA_IMM, JIT_EXIT_NEXT);
+    emit(RTS);
+    e->exit_pc[JIT_EXIT_NEXT] = e->exit_pc[JIT_EXIT_TAKEN] = pc;
+    return len;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 6502 code emitter for guest basic blocks, shared by the runtime translator
+ * (jit.c) and the host tool building the ahead-of-time overlays
+ * (tools/aotgen.c).
+ *
+ * The emitted code is position independent, apart from the absolute
+ * addresses of the guest registers. It is called with JSR and returns the
+ * exit the block took in A.
+ */
+
+enum {
+    JIT_EXIT_NEXT,  /**< fell through, or branch not taken */
+    JIT_EXIT_TAKEN, /**< branch or jump taken */
+};
+
+/* native code of a block */
+typedef uint8_t (*jit_code_t)(void);
+
+typedef struct {
+    uint8_t *pos;        /**< where the next byte goes */
+    uint8_t *end;        /**< end of the code buffer */
+    bool full;           /**< set when the code did not fit */
+    uint16_t regs;       /**< 6502 address of the guest register file */
+    bool planes;         /**< registers in byte planes, see REG_PLANES */
+    uint32_t exit_pc[2]; /**< next guest pc for each exit */
+} jit_emit_t;
+
+/* Translate up to max_len guest instructions from the virtual address pc on,
+ * without leaving the page. The instruction words are read through fetch,
+ * from the physical address addr on. Returns the number of instructions
+ * translated, and zero (without emitting anything) if the first one cannot
+ * be. e->full has to be checked in addition.
+ */
+uint8_t jit_emit_block(jit_emit_t *e,
+                       uint32_t pc,
+                       uint32_t addr,
+                       uint8_t max_len,
+                       uint32_t (*fetch)(uint32_t addr));
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bus.h"
 #include "device.h"
 #include "debug.h"
 #include "riscv.h"
@@ -12,6 +13,7 @@
 
 #include "reu.h"
 #include "display.h"
+#include "aot.h"
 
 /* SBI */
 #define SBI_IMPL_ID 0x999
@@ -21,38 +23,50 @@
 #define RV_MARCHID ((1UL << 31) | 1)
 #define RV_MIMPID 1
 
-#define SBI_HANDLE(TYPE) ret = handle_sbi_ecall_##TYPE(vm, vm->x_regs[RV_R_A6])
+#define SBI_HANDLE(TYPE) \
+    ret = handle_sbi_ecall_##TYPE(vm, vm_get_reg(vm, RV_R_A6))
 
 typedef struct {
     int32_t error;
     int32_t value;
 } sbi_ret_t;
 
-static void mem_fetch(vm_t *vm, uint32_t addr, uint32_t *value);
-static void mem_load(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value);
-static void mem_store(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value);
+#if !SEMU_HAS(STATIC_BUS)
+/* the memory bus of bus.h as callbacks, riscv.c calls it directly with
+ * STATIC_BUS
+ */
+static void mem_fetch(vm_t *vm, uint32_t addr, uint32_t *value)
+{
+    bus_fetch(vm, addr, value);
+}
+
+static void mem_load(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value)
+{
+    bus_load(vm, addr, width, value);
+}
+
+static void mem_store(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value)
+{
+    bus_store(vm, addr, width, value);
+}
+
+static void mem_zero(vm_t *vm, uint32_t addr, uint16_t len)
+{
+    bus_zero(vm, addr, len);
+}
+#endif
 
 emu_state_t emu;
 vm_t vm = {
         .priv = &emu,
+#if !SEMU_HAS(STATIC_BUS)
         .mem_fetch = mem_fetch,
         .mem_load = mem_load,
-        .mem_store = mem_store
+        .mem_store = mem_store,
+        .mem_zero = mem_zero
+#endif
 };
 
-/* Define fetch separately since it is simpler (fixed width, already checked
- * alignment, only main RAM is executable).
- */
-static void mem_fetch(vm_t *vm, uint32_t addr, uint32_t *value)
-{
-    if (unlikely(addr >= RAM_SIZE)) {
-        /* TODO: check for other regions */
-        vm_set_exception(vm, RV_EXC_FETCH_FAULT, vm->exc_val);
-        return;
-    }
-    *value = loadword_reu(addr& 0xfffffffc);
-}
-
 static void emu_update_uart_interrupts(vm_t *vm)
 {
     emu_state_t *data = (emu_state_t *) vm->priv;
@@ -88,17 +102,10 @@ static void emu_update_vblk_interrupts(vm_t *vm)
 }
 #endif
 
-static void mem_load(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value)
+void bus_load_mmio(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value)
 {
     emu_state_t *data = (emu_state_t *) vm->priv;
 
-    /*
-     * test if addr in RAM at 0x00000000 + RAM_SIZE
-     */
-    if (addr < RAM_SIZE) {
-        ram_read(vm, data->ram, addr, width, value);
-        return;
-    }
     /*
      * test if addr in MMIO at 0xF_______
      */
@@ -133,17 +140,10 @@ static void mem_load(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value)
     vm_set_exception(vm, RV_EXC_LOAD_FAULT, vm->exc_val);
 }
 
-static void mem_store(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value)
+void bus_store_mmio(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value)
 {
     emu_state_t *data = (emu_state_t *) vm->priv;
 
-    /*
-     * test if addr in RAM at 0x00000000 + RAM_SIZE
-     */
-    if (addr < RAM_SIZE) {
-        ram_write(vm, data->ram, addr, width, value);
-        return;
-    }
     /*
      * test if addr in MMIO at 0xF_______
      */
@@ -178,6 +178,39 @@ static void mem_store(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value)
     vm_set_exception(vm, RV_EXC_STORE_FAULT, vm->exc_val);
 }
 
+/**
+ * @brief skip the instructions the guest would spend idling after a WFI
+ *
+ * @param vm        vm waiting for an interrupt
+ *
+ * @note: the instruction count moves on to the first value at which the
+ * timer check in semu_start() fires, so the guest sees the same time as if
+ * it had run an idle loop up to there. Without an armed timer only an
+ * input interrupt can end the wait and nothing is skipped.
+ */
+static void emu_wfi(vm_t *vm)
+{
+    emu_state_t *data = (emu_state_t *) vm->priv;
+    uint32_t lo, hi;
+
+    if (data->timer_hi == 0xFFFFFFFF && data->timer_lo == 0xFFFFFFFF)
+        return;
+    if (vm->insn_count_hi > data->timer_hi ||
+        (vm->insn_count_hi == data->timer_hi && vm->insn_count > data->timer_lo))
+        return;
+    lo = data->timer_lo + 1;
+    hi = data->timer_hi + (lo == 0);
+    /*
+     * count the skipped instructions
+     */
+    data->idle_hi += hi - vm->insn_count_hi - (lo < vm->insn_count);
+    lo -= vm->insn_count;
+    data->idle_lo += lo;
+    data->idle_hi += data->idle_lo < lo;
+    vm->insn_count += lo;
+    vm->insn_count_hi = hi;
+}
+
 static inline sbi_ret_t handle_sbi_ecall_TIMER(vm_t *vm, int32_t fid)
 {
     emu_state_t *data = (emu_state_t *) vm->priv;
@@ -185,8 +218,8 @@ static inline sbi_ret_t handle_sbi_ecall_TIMER(vm_t *vm, int32_t fid)
     
     switch (fid) {
         case SBI_TIMER__SET_TIMER:
-                data->timer_lo = vm->x_regs[RV_R_A0];
-                data->timer_hi = vm->x_regs[RV_R_A1];
+                data->timer_lo = vm_get_reg(vm, RV_R_A0);
+                data->timer_hi = vm_get_reg(vm, RV_R_A1);
                 retval.error = SBI_SUCCESS;
     }
     return retval;
@@ -222,7 +255,7 @@ static inline sbi_ret_t handle_sbi_ecall_BASE(vm_t *vm, int32_t fid)
                 return (sbi_ret_t){SBI_SUCCESS, (0UL << 24) | 3}; /* version 0.3 */
         case SBI_BASE__PROBE_EXTENSION:
                 {
-                    int32_t eid = (int32_t) vm->x_regs[RV_R_A0];
+                    int32_t eid = (int32_t) vm_get_reg(vm, RV_R_A0);
                     bool available = eid == SBI_EID_BASE || eid == SBI_EID_TIMER || eid == SBI_EID_RST;
                     return (sbi_ret_t){SBI_SUCCESS, available};
                 }
@@ -235,7 +268,7 @@ static void handle_sbi_ecall(vm_t *vm)
 {
     sbi_ret_t ret;
 
-    switch (vm->x_regs[RV_R_A7]) {
+    switch (vm_get_reg(vm, RV_R_A7)) {
         case SBI_EID_BASE:
             SBI_HANDLE(BASE);
             break;
@@ -248,8 +281,8 @@ static void handle_sbi_ecall(vm_t *vm)
         default:
             ret = (sbi_ret_t){SBI_ERR_NOT_SUPPORTED, 0};
     }
-    vm->x_regs[RV_R_A0] = (uint32_t) ret.error;
-    vm->x_regs[RV_R_A1] = (uint32_t) ret.value;
+    vm_set_reg(vm, RV_R_A0, (uint32_t) ret.error);
+    vm_set_reg(vm, RV_R_A1, (uint32_t) ret.value);
     /* Clear error to allow execution to continue */
     vm->error = ERR_NONE;
 }
@@ -259,8 +292,11 @@ static int semu_start(int argc, char **argv)
 {
     (void) argc;
     (void) argv;
-    uint8_t peripheral_update_ctr = 0;      /** @brief peripheral update counter */
-    uint8_t debug_update_ctr = 0;      /** @brief peripheral update counter */
+    uint16_t peripheral_update_ctr = 0;     /** @brief steps until next peripheral update */
+    uint16_t debug_update_ctr = 0;          /** @brief steps until next debug menu check */
+    uint16_t budget;
+    vm_run_t reason;
+    bool idle = false;                      /** @brief waiting for an interrupt after WFI */
     uint32_t dtb_addr = RAM_SIZE - INITRD_SIZE - DTB_SIZE;
     /*
      * Initialize the emulator
@@ -272,8 +308,8 @@ static int semu_start(int argc, char **argv)
     emu.timer_hi = emu.timer_lo = 0xFFFFFFFF;
     vm.page_table_addr = 0;
     vm.s_mode = true;
-    vm.x_regs[RV_R_A0] = 0; /* hart ID. i.e., cpuid */
-    vm.x_regs[RV_R_A1] = dtb_addr;
+    vm_set_reg(&vm, RV_R_A0, 0); /* hart ID. i.e., cpuid */
+    vm_set_reg(&vm, RV_R_A1, dtb_addr);
     /* Set up peripherals */
     emu.uart.in_fd = 0, emu.uart.out_fd = 1;
     /*
@@ -299,12 +335,20 @@ static int semu_start(int argc, char **argv)
     display_printf("C-64 semu risc-v emulator\n");
     display_printf("Git commit: $Id: 7fd94cf6e0e62f69375dd3ee60ebf7bd275884d0 $\n");
     display_printf("emu state begin: 0x%p, size: 0x%04x\n", &emu, sizeof(emu));
-    display_printf("vm state begin: 0x%p, size: 0x%04x\n\n", &vm, sizeof(vm));
+    display_printf("vm state begin: 0x%p, size: 0x%04x\n", &vm, sizeof(vm));
+    display_printf("reu cache: %u ways, %u sets, %u byte lines\n\n", REU_CACHE_WAYS, REU_CACHE_SETS, REU_CACHE_LINE);
+#if SEMU_HAS(AOT)
+    if( aot_init( &vm ) )
+        display_printf("aot overlays: %lu pages\n\n", aot_pages );
+    else
+        display_printf("aot overlays: none for this build\n\n");
+#endif
     /*
      * run the emulator
      */
     while (!emu.stopped) {
-        if (peripheral_update_ctr-- == 0) {
+        if (peripheral_update_ctr == 0) {
+            peripheral_update_ctr = 256;
             display_update_cursor();
             u8250_check_ready(&emu.uart);
             if (emu.uart.in_ready)
@@ -325,18 +369,42 @@ static int semu_start(int argc, char **argv)
                 vm.sip |= RV_INT_STI_BIT;
             else
                 vm.sip &= ~RV_INT_STI_BIT;
+            vm_update_irq(&vm);
 
             /* Stop after fixed amount of instructions for performance testing or
                to cross-check instruction traces etc. */
             //if (vm.insn_count > 200000000) exit(0);
         }
 
-        if( debug_update_ctr-- == 0 ) {
-            debug_update_ctr = debug_menu( &vm );
+        if( debug_update_ctr == 0 ) {
+            debug_update_ctr = debug_menu( &vm ) + 1;
         }
-
-        vm_step(&vm);
-        if (likely(!vm.error))
+        /*
+         * after a WFI, only poll the peripherals until an interrupt is pending
+         */
+        if( idle ) {
+            if( !( vm.sip & vm.sie ) ) {
+                peripheral_update_ctr = debug_update_ctr = 0;
+                continue;
+            }
+            idle = false;
+        }
+        /*
+         * run until the next peripheral update or debug menu check, or
+         * until straight-line execution ends
+         */
+        budget = peripheral_update_ctr < debug_update_ctr ? peripheral_update_ctr : debug_update_ctr;
+        reason = vm_run(&vm, budget);
+        budget -= vm.budget;
+        peripheral_update_ctr -= budget;
+        debug_update_ctr -= budget;
+        if (reason == VM_RUN_WFI) {
+            emu_wfi(&vm);
+            peripheral_update_ctr = 0;
+            idle = true;
+            continue;
+        }
+        if (likely(reason != VM_RUN_ERROR))
             continue;
 
         if (vm.error == ERR_EXCEPTION && vm.exc_cause == RV_EXC_ECALL_S) {
@@ -348,10 +416,12 @@ static int semu_start(int argc, char **argv)
             vm_trap(&vm);
             continue;
         }
+        reu_flush();
         return 2;
     }
 
-    /* unreachable */
+    /* leave the REU with the final guest RAM, dirty cache lines included */
+    reu_flush();
     return 0;
 }
 
@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "muldiv.h"
+
+/* floor(n * n / 4) for n = 0..511, split into low and high bytes */
+#define SQR_LO(n) ((uint8_t) ((uint32_t) (n) * (n) / 4))
+#define SQR_HI(n) ((uint8_t) ((uint32_t) (n) * (n) / 4 >> 8))
+#define SQR4(f, n) f(n), f(n + 1), f(n + 2), f(n + 3)
+#define SQR16(f, n) \
+    SQR4(f, n), SQR4(f, n + 4), SQR4(f, n + 8), SQR4(f, n + 12)
+#define SQR64(f, n) \
+    SQR16(f, n), SQR16(f, n + 16), SQR16(f, n + 32), SQR16(f, n + 48)
+#define SQR256(f, n) \
+    SQR64(f, n), SQR64(f, n + 64), SQR64(f, n + 128), SQR64(f, n + 192)
+
+static const uint8_t sqr_lo[512] = {SQR256(SQR_LO, 0), SQR256(SQR_LO, 256)};
+static const uint8_t sqr_hi[512] = {SQR256(SQR_HI, 0), SQR256(SQR_HI, 256)};
+
+/* a * b = (a + b)^2 / 4 - (a - b)^2 / 4, where the truncation of both
+ * quarters cancels out as a + b and a - b are both odd or both even
+ */
+static inline uint16_t mul8(uint8_t a, uint8_t b)
+{
+    const uint16_t s = (uint16_t) a + b;
+    const uint8_t d = a > b ? a - b : b - a;
+    return (uint16_t) (sqr_lo[s] | (uint16_t) sqr_hi[s] << 8) -
+           (uint16_t) (sqr_lo[d] | (uint16_t) sqr_hi[d] << 8);
+}
+
+/* Number of significant bits in x, which must not be zero */
+static uint8_t bit_length(uint32_t x)
+{
+    uint8_t bytes[4];
+    memcpy(bytes, &x, sizeof(bytes));
+
+    uint8_t i = 3;
+    while (!bytes[i])
+        i--;
+    uint8_t n = 8 * i;
+    for (uint8_t top = bytes[i]; top; top >>= 1)
+        n++;
+    return n;
+}
+
+/* Significant bytes in x[4], least significant first */
+static uint8_t byte_length(const uint8_t *x)
+{
+    uint8_t n = 4;
+    while (n && !x[n - 1])
+        n--;
+    return n;
+}
+
+uint32_t mul32(uint32_t a, uint32_t b, uint32_t *hi)
+{
+    /* multiplying by a power of two is a shift */
+    if (a && !(a & (a - 1))) {
+        const uint32_t t = a;
+        a = b;
+        b = t;
+    }
+    if (b && !(b & (b - 1))) {
+        const uint8_t n = bit_length(b) - 1;
+        if (hi)
+            *hi = n ? a >> (32 - n) : 0;
+        return a << n;
+    }
+
+    uint8_t x[4], y[4], r[8];
+    memcpy(x, &a, sizeof(x));
+    memcpy(y, &b, sizeof(y));
+    const uint8_t nx = byte_length(x), ny = byte_length(y);
+
+    /* column k sums the partial products of bytes i + j = k */
+    const uint8_t cols = hi ? 8 : 4;
+    uint32_t acc = 0;
+    for (uint8_t k = 0; k < cols; k++) {
+        for (uint8_t i = 0; i < nx && i <= k; i++) {
+            const uint8_t j = k - i;
+            if (j < ny && x[i] && y[j])
+                acc += mul8(x[i], y[j]);
+        }
+        r[k] = (uint8_t) acc;
+        acc >>= 8;
+    }
+
+    uint32_t lo;
+    memcpy(&lo, r, sizeof(lo));
+    if (hi)
+        memcpy(hi, r + 4, sizeof(*hi));
+    return lo;
+}
+
+uint32_t divu32(uint32_t a, uint32_t b, uint32_t *rem)
+{
+    if (a < b) {
+        *rem = a;
+        return 0;
+    }
+    if (!(b & (b - 1))) {
+        *rem = a & (b - 1);
+        return a >> (bit_length(b) - 1);
+    }
+    if (!(a >> 16)) {
+        /* both fit the much cheaper 16-bit division */
+        *rem = (uint16_t) a % (uint16_t) b;
+        return (uint16_t) a / (uint16_t) b;
+    }
+    if (!(b >> 8)) {
+        /* short division a byte at a time, the partial remainder stays
+         * below b and so each step is a 16 by 8 bit one
+         */
+        uint8_t x[4];
+        memcpy(x, &a, sizeof(x));
+        uint16_t r = 0;
+        for (uint8_t i = 4; i--;) {
+            r = r << 8 | x[i];
+            x[i] = r / (uint8_t) b;
+            r %= (uint8_t) b;
+        }
+        *rem = r;
+        memcpy(&a, x, sizeof(a));
+        return a;
+    }
+
+    /* shift and subtract, one round per quotient bit */
+    const uint8_t n = bit_length(a) - bit_length(b);
+    uint32_t q = 0;
+    b <<= n;
+    for (uint8_t i = 0; i <= n; i++) {
+        q <<= 1;
+        if (a >= b) {
+            a -= b;
+            q |= 1;
+        }
+        b >>= 1;
+    }
+    *rem = a;
+    return q;
+}
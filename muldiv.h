@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/* 32-bit multiply and divide for the M extension
+ *
+ * The compiler runtime does both bit-serially, 32 or 64 rounds of 32- and
+ * 64-bit shifts and adds. Here products are summed from 8x8 bit partial
+ * products looked up in quarter-square tables, skipping zero bytes, and
+ * division takes shortcuts for powers of two and small operands before
+ * falling back to shift-and-subtract over the quotient bits only.
+ */
+
+/* a * b, the upper 32 bits of the unsigned product go to *hi unless it is
+ * NULL, which saves the partial products only needed for them
+ */
+uint32_t mul32(uint32_t a, uint32_t b, uint32_t *hi);
+
+/* a / b with the remainder in *rem, b must not be zero */
+uint32_t divu32(uint32_t a, uint32_t b, uint32_t *rem);
@@ -14,6 +14,7 @@ void plic_update_interrupts(vm_t *vm, plic_state_t *plic)
         vm->sip |= RV_INT_SEI_BIT;
     else
         vm->sip &= ~RV_INT_SEI_BIT;
+    vm_update_irq(vm);
 }
 
 static bool plic_reg_read(plic_state_t *plic, uint32_t addr, uint32_t *value)
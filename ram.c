@@ -1,3 +1,4 @@
+#include "device.h"
 #include "riscv.h"
 #include "riscv_private.h"
 
@@ -6,26 +7,75 @@
 /* RAM handlers (address must be relative, assumes it is within bounds) */
 #define RAM_FUNC(width, code, write)                      \
     do {                                                  \
-        if (unlikely((addr & (width - 1)))) {             \
-            vm_set_exception(vm, exc_cause, vm->exc_val); \
-            break;                                        \
-        }                                                 \
         UNUSED uint8_t offset = (addr & 0b11) * 8;        \
         uint32_t addr4 = addr & 0xfffffffc;               \
         uint32_t v;                                       \
         uint32_t *cell = &v;                              \
+        if (unlikely((addr & (width - 1)))) {             \
+            RAM_MISALIGNED(width, code, write);           \
+            break;                                        \
+        }                                                 \
         v=loadword_reu(addr4);                            \
         code;                                             \
         if (write) saveword_reu(addr4, v);                \
     } while (0)
 
+#if SEMU_HAS(MISALIGNED)
+uint32_t ram_misaligned;
+
+/* The size bytes at the misaligned addr in the low bytes of the result. They
+ * may continue in the next word, which may be in the next REU cache page.
+ */
+static uint32_t ram_load_misaligned(const uint32_t addr, const uint8_t size)
+{
+    const uint32_t addr4 = addr & 0xfffffffc;
+    const uint8_t offset = (addr & 0b11) * 8;
+    uint32_t v = loadword_reu(addr4) >> offset;
+
+    if (offset + size * 8 > 32)
+        v |= loadword_reu(addr4 + 4) << (32 - offset);
+    return v;
+}
+
+/* Store the size low bytes of v at the misaligned addr */
+static void ram_store_misaligned(const uint32_t addr,
+                                 const uint8_t size,
+                                 const uint32_t v)
+{
+    const uint32_t addr4 = addr & 0xfffffffc;
+    const uint8_t offset = (addr & 0b11) * 8;
+    const uint32_t mask = size == 4 ? 0xffffffff : MASK(16);
+
+    saveword_reu(addr4, (loadword_reu(addr4) & ~(mask << offset)) |
+                            (v & mask) << offset);
+    if (offset + size * 8 > 32)
+        saveword_reu(addr4 + 4,
+                     (loadword_reu(addr4 + 4) & ~(mask >> (32 - offset))) |
+                         (v & mask) >> (32 - offset));
+}
+
+/* The accessed bytes go through the aligned code in the low bytes of v */
+#define RAM_MISALIGNED(width, code, write)                 \
+    do {                                                   \
+        ram_misaligned++;                                  \
+        offset = 0;                                        \
+        v = ram_load_misaligned(addr, width);              \
+        code;                                              \
+        if (write)                                         \
+            ram_store_misaligned(addr, width, v);          \
+    } while (0)
+#else
+#define RAM_MISALIGNED(width, code, write) \
+    vm_set_exception(vm, exc_cause, vm->exc_val)
+#endif
+
 void ram_read(vm_t *vm,
               uint32_t *mem,
               const uint32_t addr,
               const uint8_t width,
               uint32_t *value)
 {
-    const uint32_t exc_cause = RV_EXC_LOAD_MISALIGN;
+    UNUSED const uint32_t exc_cause = RV_EXC_LOAD_MISALIGN;
     (void)(mem);
 
     switch (width) {
@@ -57,7 +107,7 @@ void ram_write(vm_t *vm,
                const uint8_t width,
                const uint32_t value)
 {
-    const uint32_t exc_cause = RV_EXC_STORE_MISALIGN;
+    UNUSED const uint32_t exc_cause = RV_EXC_STORE_MISALIGN;
     (void)(mem);
 
     switch (width) {
@@ -77,3 +127,12 @@ void ram_write(vm_t *vm,
             return;
     }
 }
+
+/* Zero len bytes at the aligned addr in a single fill of the REU */
+void ram_zero(vm_t *vm, uint32_t *mem, const uint32_t addr, uint16_t len)
+{
+    (void)(vm);
+    (void)(mem);
+
+    reu_fill(addr, 0, len);
+}
@@ -1,13 +1,144 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef REU_HOST
 #include <c64.h>
+#endif
 
 #include "reu.h"
 
-volatile uint32_t reu_addr = 0xf0000000;
-volatile uint32_t reu_page[ REU_PAGE_SIZE / 4 ];
+/**
+ * @brief the word cache
+ *
+ * REU_CACHE_SETS sets of REU_CACHE_WAYS lines with REU_CACHE_LINE bytes each.
+ * The set of an address is given by the bits right above the line offset.
+ * reu_ways[] lists the lines of each set, the most recently used first, so
+ * that a hit on it takes a single compare and a miss replaces the last one.
+ * With REU_WRITEBACK, stores only go to the cached line and mark it dirty,
+ * it is written back to reu when it is replaced, flushed or transferred.
+ */
+typedef struct {
+    uint32_t    tag;                                            /** line address | 1, zero if empty */
+    uint8_t     line;                                           /** index of the line in reu_lines[] */
+    bool        dirty;                                          /** changed since loaded from reu */
+} reu_way_t;
+
+static reu_way_t reu_ways[ REU_CACHE_SETS ][ REU_CACHE_WAYS ];
+static volatile uint32_t reu_lines[ REU_CACHE_SETS ][ REU_CACHE_WAYS ][ REU_CACHE_LINE / 4 ];
+static bool reu_ways_ready = false;
+
+/**
+ * @brief the fetch line
+ *
+ * Instruction fetches have a line of their own, so that data accesses do not
+ * evict the code being run. Fetches mostly go on with the next word, which is
+ * then taken from reu_fetch_next without looking at the tag.
+ */
+static volatile uint32_t reu_fetch_line[ REU_CACHE_LINE / 4 ];
+static uint32_t reu_fetch_tag = 0;                              /** line address | 1, zero if empty */
+static uint32_t reu_fetch_addr = 1;                             /** address of the next word, odd if none */
+static volatile uint32_t *reu_fetch_next;                       /** the next word in reu_fetch_line[] */
+
+uint32_t reu_hits;
+uint32_t reu_misses;
+
+/**
+ * @brief run a dma transfer between c64 memory and reu
+ *
+ * @param c64           c64 address
+ * @param addr          reu address
+ * @param len           number of bytes
+ * @param cmd           REU_CMD_C64_TO_REU or REU_CMD_REU_TO_C64
+ * @param ctrl          address control, REU_ADDR_FIX_C64 or zero
+ *
+ * @note: with REU_HOST the host does the transfer, tools/reutest.c runs the
+ * cache that way against a flat array
+ */
+#ifdef REU_HOST
+void reu_dma( volatile void *c64, uint32_t addr, uint16_t len, uint8_t cmd, uint8_t ctrl );
+#else
+static inline void reu_dma( volatile void *c64, uint32_t addr, uint16_t len, uint8_t cmd, uint8_t ctrl ) {
+    REU.c64_address = (uint16_t)c64;
+    REU.reu_address_lo = addr & 0xffff;
+    REU.reu_address_hi = addr >> 16;
+    REU.transfer_length = len;
+    if( ctrl )
+        REU.addr_ctrl = ctrl;
+    REU.command = ( REU_CMD_EXEC | REU_CMD_DIS_DECODE | cmd );
+    if( ctrl )
+        REU.addr_ctrl = 0;
+}
+#endif
+
+/**
+ * @brief get the set an address falls into
+ */
+static inline uint16_t reu_set( uint32_t addr ) {
+    return( ( addr / REU_CACHE_LINE ) & ( REU_CACHE_SETS - 1 ) );
+}
+
+/**
+ * @brief get the tag of the line an address falls into
+ */
+static inline uint32_t reu_tag( uint32_t addr ) {
+    return( ( addr & ~( uint32_t )( REU_CACHE_LINE - 1 ) ) | 1 );
+}
+
+/**
+ * @brief look up a tag in a set
+ *
+ * @param ways          ways of the set
+ * @param tag           tag to look for
+ * @return uint8_t      line holding the tag, which is now the most recently
+ *                      used, or REU_CACHE_WAYS on a miss
+ */
+static inline uint8_t reu_find( reu_way_t *ways, uint32_t tag ) {
+    for( uint8_t i = 0 ; i < REU_CACHE_WAYS ; i++ ) {
+        if( ways[ i ].tag != tag )
+            continue;
+        reu_way_t hit = ways[ i ];
+        for( ; i ; i-- )
+            ways[ i ] = ways[ i - 1 ];
+        ways[ 0 ] = hit;
+        return( hit.line );
+    }
+    return( REU_CACHE_WAYS );
+}
+
+/**
+ * @brief write a dirty line back to reu
+ *
+ * @param set           set of the line
+ * @param way           the line in the set
+ */
+static void reu_writeback( uint16_t set, reu_way_t *way ) {
+    reu_dma( &reu_lines[ set ][ way->line ], way->tag - 1, REU_CACHE_LINE, REU_CMD_C64_TO_REU, 0 );
+    way->dirty = false;
+}
+
+/**
+ * @brief write back the dirty lines overlapping a block of reu memory
+ *
+ * @param addr      reu address of the block
+ * @param len       number of bytes
+ * @param drop      drop the overlapping lines from the cache as well
+ */
+static void reu_sync( uint32_t addr, uint32_t len, bool drop ) {
+    for( uint16_t s = 0 ; s < REU_CACHE_SETS ; s++ ) {
+        for( uint8_t i = 0 ; i < REU_CACHE_WAYS ; i++ ) {
+            reu_way_t *way = &reu_ways[ s ][ i ];
+            const uint32_t line = way->tag & ~1UL;
+            if( !( line < addr + len && addr < line + REU_CACHE_LINE ) )
+                continue;
+            if( way->dirty )
+                reu_writeback( s, way );
+            if( drop )
+                way->tag = 0;
+        }
+    }
+}
 
 /**
  * @brief load a word from reu
@@ -15,28 +146,81 @@ volatile uint32_t reu_page[ REU_PAGE_SIZE / 4 ];
  * @param addr          address to load from
  * @return uint32_t     word from reu
  *
- * @note: on first run ( addr = 0x00000000) we have a cache miss
- * and load the first page from reu
+ * @note: the cache starts out empty, so the first load of each line is a miss
+ * that loads the line from reu
  */
 uint32_t loadword_reu(uint32_t addr) {
+    const uint32_t tag = reu_tag( addr );
+    const uint16_t set = reu_set( addr );
+    reu_way_t *ways = reu_ways[ set ];
+    uint8_t line = reu_find( ways, tag );
     /*
      * check for cache miss
      */
-    if( ( addr & 0xffffff00 ) != reu_addr ) {
+    if( line == REU_CACHE_WAYS ) {
+        reu_misses++;
+        /*
+         * number the lines of each set on the first miss, the tags are all
+         * zero until then, so that no lookup can hit before
+         */
+        if( !reu_ways_ready ) {
+            for( uint16_t s = 0 ; s < REU_CACHE_SETS ; s++ )
+                for( uint8_t i = 0 ; i < REU_CACHE_WAYS ; i++ )
+                    reu_ways[ s ][ i ].line = i;
+            reu_ways_ready = true;
+        }
+        /*
+         * replace the least recently used line with the new one from reu
+         */
+        if( ways[ REU_CACHE_WAYS - 1 ].dirty )
+            reu_writeback( set, &ways[ REU_CACHE_WAYS - 1 ] );
+        line = ways[ REU_CACHE_WAYS - 1 ].line;
+        for( uint8_t i = REU_CACHE_WAYS - 1 ; i ; i-- )
+            ways[ i ] = ways[ i - 1 ];
+        ways[ 0 ].tag = tag;
+        ways[ 0 ].line = line;
+        ways[ 0 ].dirty = false;
+        reu_dma( &reu_lines[ set ][ line ], tag - 1, REU_CACHE_LINE, REU_CMD_REU_TO_C64, 0 );
+    }
+    else
+        reu_hits++;
+    /*
+     * get word from cache
+     */
+    return( reu_lines[ set ][ line ][ ( addr & ( REU_CACHE_LINE - 1 ) ) >> 2 ] );
+}
+
+/**
+ * @brief fetch an instruction word from reu
+ *
+ * @param addr          address to fetch from
+ * @return uint32_t     word from reu
+ */
+uint32_t fetchword_reu( uint32_t addr ) {
+    if( addr != reu_fetch_addr ) {
+        const uint32_t tag = reu_tag( addr );
         /*
-         * read new page from reu
+         * check for fetch line miss
          */
-        reu_addr = addr & 0xffffff00;        
-        REU.c64_address = (uint16_t)&reu_page;
-        REU.reu_address_lo = reu_addr & 0xffff;
-        REU.reu_address_hi = reu_addr >> 16;
-        REU.transfer_length = REU_PAGE_SIZE;
-        REU.command = ( REU_CMD_EXEC | REU_CMD_DIS_DECODE | REU_CMD_REU_TO_C64 );
+        if( tag != reu_fetch_tag ) {
+            /*
+             * a dirty data line has the newer words
+             */
+            const uint16_t set = reu_set( addr );
+            for( uint8_t i = 0 ; i < REU_CACHE_WAYS ; i++ ) {
+                if( reu_ways[ set ][ i ].tag == tag && reu_ways[ set ][ i ].dirty )
+                    reu_writeback( set, &reu_ways[ set ][ i ] );
+            }
+            reu_fetch_tag = tag;
+            reu_dma( &reu_fetch_line, tag - 1, REU_CACHE_LINE, REU_CMD_REU_TO_C64, 0 );
+        }
+        reu_fetch_next = &reu_fetch_line[ ( addr & ( REU_CACHE_LINE - 1 ) ) >> 2 ];
     }
     /*
-     * get byte from cache
+     * the next word follows in the line, unless this is its last one
      */
-    return( reu_page[ ( addr & 0xff ) >> 2 ] );
+    reu_fetch_addr = ( ~addr & ( REU_CACHE_LINE - 4 ) ) ? addr + 4 : 1;
+    return( *reu_fetch_next++ );
 }
 
 /**
@@ -46,17 +230,76 @@ uint32_t loadword_reu(uint32_t addr) {
  * @param value     value to store
  */
 void saveword_reu( uint32_t addr, volatile uint32_t value ) {
+    const uint32_t tag = reu_tag( addr );
+    const uint16_t set = reu_set( addr );
+    const uint8_t line = reu_find( reu_ways[ set ], tag );
+    /*
+     * keep the fetch line up to date
+     */
+    if( tag == reu_fetch_tag )
+        reu_fetch_line[ ( addr & ( REU_CACHE_LINE - 1 ) ) >> 2 ] = value;
     /*
      * check for cache hit
      */
-    if( ( addr & 0xffffff00 ) == reu_addr )
-        reu_page[ ( addr & 0xff ) >> 2 ] = value;
+    if( line != REU_CACHE_WAYS ) {
+        reu_lines[ set ][ line ][ ( addr & ( REU_CACHE_LINE - 1 ) ) >> 2 ] = value;
+#if SEMU_HAS(REU_WRITEBACK)
+        reu_ways[ set ][ 0 ].dirty = true;
+        return;
+#endif
+    }
     /*
-     * always write to reu
+     * write to reu, always without REU_WRITEBACK
      */
-    REU.c64_address = (uint16_t)(&value);
-    REU.reu_address_lo = addr & 0xffff;
-    REU.reu_address_hi = addr >> 16;
-    REU.transfer_length = 4;
-    REU.command = ( REU_CMD_EXEC | REU_CMD_DIS_DECODE | REU_CMD_C64_TO_REU );
+    reu_dma( &value, addr, 4, REU_CMD_C64_TO_REU, 0 );
+}
+
+/**
+ * @brief copy a block from reu into c64 memory
+ * 
+ * @param dst       c64 address to copy to
+ * @param addr      reu address to copy from
+ * @param len       number of bytes
+ *
+ * @note: dirty lines of the word cache overlapping the block are written back
+ * first
+ */
+void reu_read( void *dst, uint32_t addr, uint16_t len ) {
+    reu_sync( addr, len, false );
+    reu_dma( dst, addr, len, REU_CMD_REU_TO_C64, 0 );
+}
+
+/**
+ * @brief fill a block of reu memory with a byte
+ * 
+ * @param addr      reu address to fill from
+ * @param value     byte to fill with
+ * @param len       number of bytes
+ *
+ * @note: a single transfer from a fixed c64 address, that is the one byte
+ * is copied into each of the len bytes at dma speed
+ */
+void reu_fill( uint32_t addr, uint8_t value, uint16_t len ) {
+    static volatile uint8_t fill;
+
+    /*
+     * drop the cached lines overlapping the block, the parts of dirty ones
+     * outside of it have to be written back first
+     */
+    reu_sync( addr, len, true );
+    if( ( reu_fetch_tag & ~1UL ) < addr + len && addr < ( reu_fetch_tag & ~1UL ) + REU_CACHE_LINE ) {
+        reu_fetch_tag = 0;
+        reu_fetch_addr = 1;
+    }
+    fill = value;
+    reu_dma( &fill, addr, len, REU_CMD_C64_TO_REU, REU_ADDR_FIX_C64 );
+}
+
+/**
+ * @brief write all dirty lines of the word cache back to reu
+ *
+ * @note: the lines stay cached
+ */
+void reu_flush( void ) {
+    reu_sync( 0, REU_SIZE, false );
 }
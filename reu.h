@@ -18,21 +18,53 @@ struct __REU {
  * @brief REU defines   
  */
 #define REU                 (*(volatile struct __REU*)0xDF00)   /** REU I/O base address */
-#define REU_PAGE_SIZE       0x100                               /** REU cache size */
 #define REU_CMD_EXEC        0x80                                /** execute command after command write */
 #define REU_CMD_DIS_DECODE  0x10                                /** disable address decoding */
 #define REU_CMD_C64_TO_REU  0x00                                /** transfer from c64 to reu */         
 #define REU_CMD_REU_TO_C64  0x01                                /** transfer from reu to c64 */
+#define REU_ADDR_FIX_C64    0x80                                /** keep the c64 address fixed */
+#define REU_SIZE            0x1000000UL                         /** 16MiB, the whole 24-bit address range */
+/**
+ * @brief geometry of the word cache in reu.c, a set-associative cache with
+ * least recently used replacement. The line size and the number of sets are
+ * powers of two, all of it has to fit into the free RAM below 0xD000 next
+ * to semu itself. The Makefile sets them. With SEMU_FEATURE_REU_WRITEBACK
+ * the cache is write-back, write-through otherwise.
+ */
+#ifndef REU_CACHE_WAYS
+#define REU_CACHE_WAYS      4                                   /** lines per set */
+#endif
+#ifndef REU_CACHE_SETS
+#define REU_CACHE_SETS      4                                   /** sets */
+#endif
+#ifndef REU_CACHE_LINE
+#define REU_CACHE_LINE      0x100                               /** bytes per line, one dma transfer */
+#endif
+/**
+ * @brief loads from the word cache that hit and missed it
+ */
+extern uint32_t reu_hits;
+extern uint32_t reu_misses;
 /**
  * @brief load a word from reu
  * 
  * @param addr          address to load from
  * @return uint32_t     word from reu
  *
- * @note: on first run ( addr = 0x00000000) we have a cache miss
- * and load the first page from reu
+ * @note: the cache starts out empty, so the first load of each line is a miss
+ * that loads the line from reu
  */
 uint32_t loadword_reu(uint32_t addr);
+/**
+ * @brief fetch an instruction word from reu
+ *
+ * @param addr          address to fetch from
+ * @return uint32_t     word from reu
+ *
+ * @note: fetches have a cache line of their own, which data accesses do not
+ * evict, and stores to it keep it up to date
+ */
+uint32_t fetchword_reu(uint32_t addr);
 /**
  * @brief store a word to reu
  * 
@@ -40,3 +72,26 @@ uint32_t loadword_reu(uint32_t addr);
  * @param value     value to store
  */
 void saveword_reu(uint32_t addr, uint32_t value);
+/**
+ * @brief copy a block from reu into c64 memory
+ * 
+ * @param dst       c64 address to copy to
+ * @param addr      reu address to copy from
+ * @param len       number of bytes
+ */
+void reu_read(void *dst, uint32_t addr, uint16_t len);
+/**
+ * @brief fill a block of reu memory with a byte
+ * 
+ * @param addr      reu address to fill from
+ * @param value     byte to fill with
+ * @param len       number of bytes
+ */
+void reu_fill(uint32_t addr, uint8_t value, uint16_t len);
+/**
+ * @brief write all dirty lines of the word cache back to reu
+ *
+ * @note: needed before anything outside semu looks at the reu, such as a
+ * snapshot or the monitor of the emulator
+ */
+void reu_flush(void);
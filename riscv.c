@@ -1,133 +1,207 @@
 #include "device.h"
+#include <setjmp.h>
+#include <stddef.h>
 #include <stdio.h>
 #include "riscv.h"
 #include "riscv_private.h"
+#include "aot.h"
+#include "asm_core.h"
+#include "bitmanip.h"
+#include "decode.h"
+#include "jit.h"
+#include "muldiv.h"
+
+/* The memory bus, which is the environment's callbacks in vm_t, or with
+ * STATIC_BUS the inline functions of bus.h, bound at compile time.
+ */
+#if SEMU_HAS(STATIC_BUS)
+#include "bus.h"
+#else
+static inline void bus_fetch(vm_t *vm, uint32_t addr, uint32_t *value)
+{
+    vm->mem_fetch(vm, addr, value);
+}
 
-static bool mmu_fetch_cache_valid = false;
-static bool mmu_load_cache_valid = false;
-static bool mmu_store_cache_valid = false;
-
-/* Instruction decoding */
-
-/* clang-format off */
-/* instruction decode masks */
-enum {
-    //               ....xxxx....xxxx....xxxx....xxxx
-    FR_RD        = 0b00000000000000000000111110000000,
-    FR_FUNCT3    = 0b00000000000000000111000000000000,
-    FR_RS1       = 0b00000000000011111000000000000000,
-    FR_RS2       = 0b00000001111100000000000000000000,
-    //               ....xxxx....xxxx....xxxx....xxxx
-    FI_IMM_11_0  = 0b11111111111100000000000000000000, // I-type
-    //               ....xxxx....xxxx....xxxx....xxxx
-    FS_IMM_4_0   = 0b00000000000000000000111110000000, // S-type
-    FS_IMM_11_5  = 0b11111110000000000000000000000000,
-    //               ....xxxx....xxxx....xxxx....xxxx
-    FB_IMM_11    = 0b00000000000000000000000010000000, // B-type
-    FB_IMM_4_1   = 0b00000000000000000000111100000000,
-    FB_IMM_10_5  = 0b01111110000000000000000000000000,
-    FB_IMM_12    = 0b10000000000000000000000000000000,
-    //               ....xxxx....xxxx....xxxx....xxxx
-    FU_IMM_31_12 = 0b11111111111111111111000000000000, // U-type
-    //               ....xxxx....xxxx....xxxx....xxxx
-    FJ_IMM_19_12 = 0b00000000000011111111000000000000, // J-type
-    FJ_IMM_11    = 0b00000000000100000000000000000000,
-    FJ_IMM_10_1  = 0b01111111111000000000000000000000,
-    FJ_IMM_20    = 0b10000000000000000000000000000000,
-    //               ....xxxx....xxxx....xxxx....xxxx
-};
-/* clang-format on */
-
-/* decode U-type instruction immediate */
-static inline uint32_t decode_u(uint32_t insn)
+/* a load, so that page walks go through the data cache of reu.c, and only
+ * in RAM, the MMU raises the fault of the access it translates for
+ */
+static inline bool bus_load_pte(vm_t *vm, uint32_t addr, uint32_t *value)
 {
-    return insn & FU_IMM_31_12;
+    if (unlikely(addr >= RAM_SIZE))
+        return false;
+    vm->mem_load(vm, addr, RV_MEM_LW, value);
+    return true;
 }
 
-/* decode I-type instruction immediate */
-static inline uint32_t decode_i(uint32_t insn)
+static inline void bus_load(vm_t *vm,
+                            uint32_t addr,
+                            uint8_t width,
+                            uint32_t *value)
 {
-    return ((int32_t) (insn & FI_IMM_11_0)) >> 20;
+    vm->mem_load(vm, addr, width, value);
 }
 
-static inline uint32_t decode_j(uint32_t insn)
+static inline void bus_store(vm_t *vm,
+                             uint32_t addr,
+                             uint8_t width,
+                             uint32_t value)
 {
-    uint32_t dst = 0;
-    dst |= (insn & FJ_IMM_20);
-    dst |= (insn & FJ_IMM_19_12) << 11;
-    dst |= (insn & FJ_IMM_11) << 2;
-    dst |= (insn & FJ_IMM_10_1) >> 9;
-    /* NOTE: shifted to 2nd least significant bit */
-    return ((int32_t) dst) >> 11;
+    vm->mem_store(vm, addr, width, value);
 }
 
-/* decode B-type instruction immediate */
-static inline uint32_t decode_b(uint32_t insn)
+/* Returns false if there is no vm->mem_zero to zero the block at once */
+static inline bool bus_zero(vm_t *vm, uint32_t addr, uint16_t len)
 {
-    uint32_t dst = 0;
-    dst |= (insn & FB_IMM_12);
-    dst |= (insn & FB_IMM_11) << 23;
-    dst |= (insn & FB_IMM_10_5) >> 1;
-    dst |= (insn & FB_IMM_4_1) << 12;
-    /* NOTE: shifted to 2nd least significant bit */
-    return ((int32_t) dst) >> 19;
+    if (!vm->mem_zero)
+        return false;
+    vm->mem_zero(vm, addr, len);
+    return true;
 }
+#endif
+
+/* the fields of vm_t up to exc_val are in reach of an 8-bit offset */
+_Static_assert(offsetof(vm_t, exc_val) + sizeof(uint32_t) <= 256,
+               "vm_t fields beyond an 8-bit offset");
+
+static bool mmu_fetch_cache_valid = false;
+
+/* Translation caches of the loads and the stores: the virtual page address
+ * last translated and the physical one it maps to, if valid. The load and
+ * store handlers of asm_core.S look them up as well, with mmu_paging telling
+ * them whether to.
+ */
+bool mmu_load_cache_valid = false;
+bool mmu_store_cache_valid = false;
+uint32_t mmu_load_from, mmu_load_to;
+uint32_t mmu_store_from, mmu_store_to;
+bool mmu_paging; /**< vm->page_table_addr != 0, set by mmu_select() */
+
+static void mmu_select(vm_t *vm);
+
+/* why vm_run() has to stop after the current step, VM_RUN_BUDGET if not */
+static vm_run_t run_reason;
 
-/* decode S-type instruction immediate */
-static inline uint32_t decode_s(uint32_t insn)
+/* Instructions are not counted one by one. The steps of a vm_run() slice
+ * are taken from slice_left, which started out as slice_budget, and
+ * vm_retire() adds the difference to vm->insn_count. A step ending in a
+ * fetch fault retires nothing and takes itself out of slice_budget.
+ */
+static uint16_t slice_budget, slice_left;
+
+/* Whether the memory access or CSR operation just made raised an exception.
+ * With UNWIND, vm_set_exception() does not return during a step, and so
+ * there is nothing left to check for.
+ */
+#if SEMU_HAS(UNWIND)
+#define vm_faulted(vm) false
+
+/* where vm_set_exception() unwinds to, set while vm_step() or vm_run() runs */
+static jmp_buf unwind_point;
+static bool unwind_armed;
+#else
+#define vm_faulted(vm) unlikely((vm)->error)
+#endif
+
+static void vm_retire(vm_t *vm)
 {
-    uint32_t dst = 0;
-    dst |= (insn & FS_IMM_11_5);
-    dst |= (insn & FS_IMM_4_0) << 13;
-    return ((int32_t) dst) >> 20;
+    const uint32_t count =
+        vm->insn_count + (uint16_t) (slice_budget - slice_left);
+    if (count < vm->insn_count)
+        vm->insn_count_hi++;
+    vm->insn_count = count;
+    slice_budget = slice_left;
 }
 
-static inline uint16_t decode_i_unsigned(uint32_t insn)
+static inline uint32_t read_rs1(const vm_t *vm, uint32_t insn)
 {
-    return insn >> 20;
+    return vm_get_reg(vm, decode_rs1(insn));
 }
 
-/* decode rd field */
-static inline uint8_t decode_rd(uint32_t insn)
+static inline uint32_t read_rs2(const vm_t *vm, uint32_t insn)
 {
-    return (insn & FR_RD) >> 7;
+    return vm_get_reg(vm, decode_rs2(insn));
 }
 
-/* decode rs1 field */
-static inline uint8_t decode_rs1(uint32_t insn)
+/* Predecoded instructions are kept in a direct-mapped table keyed by the
+ * guest physical address they were fetched from.
+ */
+
+#if SEMU_HAS(DECODE_CACHE)
+#ifndef DECODE_CACHE_SIZE
+#define DECODE_CACHE_SIZE 256 /* entries, must be a power of two */
+#endif
+
+static decoded_insn_t decode_cache[DECODE_CACHE_SIZE];
+
+/* With RVC, instructions at the upper halfword of a word go to the other half
+ * of the table, so that word-aligned code still uses all of it.
+ */
+static inline decoded_insn_t *decode_cache_slot(uint32_t addr)
 {
-    return (insn & FR_RS1) >> 15;
+#if SEMU_HAS(RVC)
+    addr ^= (addr & 0b10) * DECODE_CACHE_SIZE;
+#endif
+    return &decode_cache[(addr >> 2) & (DECODE_CACHE_SIZE - 1)];
 }
 
-/* decode rs2 field */
-static inline uint8_t decode_rs2(uint32_t insn)
+static void decode_cache_flush(void)
 {
-    return (insn & FR_RS2) >> 20;
+    for (uint16_t i = 0; i < DECODE_CACHE_SIZE; i++)
+        decode_cache[i].tag = 0;
 }
 
-/* decoded funct3 field */
-static inline uint8_t decode_func3(uint32_t insn)
+/* A store can only overlap the single aligned word it is contained in, and
+ * that word can only be cached in one slot, or be the second half of a
+ * fused pair in the slot before. With RVC, it can also hold instructions
+ * starting at its upper halfword, or the upper half of one starting at the
+ * upper halfword of the word before.
+ */
+static inline void decode_cache_snoop(uint32_t addr)
 {
-    uint8_t *t = (uint8_t*)(&insn);
-    //return (insn & FR_FUNCT3) >> 12;
-    return (t[1] >> 4)&7;
+    addr &= ~0b11;
+    decoded_insn_t *d = decode_cache_slot(addr);
+    if (unlikely(d->tag == (addr | 1)))
+        d->tag = 0;
+    d = decode_cache_slot(addr - 4);
+    if (unlikely(d->tag == ((addr - 4) | 1)))
+        d->tag = 0;
+#if SEMU_HAS(RVC)
+    d = decode_cache_slot(addr + 2);
+    if (unlikely(d->tag == ((addr + 2) | 1)))
+        d->tag = 0;
+    d = decode_cache_slot(addr - 2);
+    if (unlikely(d->tag == ((addr - 2) | 1)))
+        d->tag = 0;
+#endif
 }
 
-/* decoded funct5 field */
-static inline uint8_t decode_func5(uint32_t insn)
+/* Drop what a store of len bytes at addr overlaps, which is faster for a
+ * large block in one pass over the table than a word at a time. Like in
+ * decode_cache_snoop(), instructions from 4 bytes before it on can reach
+ * into it.
+ */
+static void decode_cache_snoop_block(uint32_t addr, uint16_t len)
 {
-    return insn >> 27;
+    for (uint16_t i = 0; i < DECODE_CACHE_SIZE; i++) {
+        if ((decode_cache[i].tag - 1) - (addr - 4) < (uint32_t) len + 4)
+            decode_cache[i].tag = 0;
+    }
 }
+#else
+static decoded_insn_t decode_scratch;
 
-static inline uint32_t read_rs1(const vm_t *vm, uint32_t insn)
+static inline decoded_insn_t *decode_cache_slot(uint32_t addr UNUSED)
 {
-    return vm->x_regs[decode_rs1(insn)];
+    return &decode_scratch;
 }
 
-static inline uint32_t read_rs2(const vm_t *vm, uint32_t insn)
+static inline void decode_cache_flush(void) {}
+static inline void decode_cache_snoop(uint32_t addr UNUSED) {}
+static inline void decode_cache_snoop_block(uint32_t addr UNUSED,
+                                            uint16_t len UNUSED)
 {
-    return vm->x_regs[decode_rs2(insn)];
 }
+#endif
 
 /* virtual addressing */
 
@@ -146,6 +220,7 @@ static void mmu_set(vm_t *vm, uint32_t satp)
     mmu_fetch_cache_valid = false;
     mmu_load_cache_valid = false;
     mmu_store_cache_valid = false;
+    jit_unlink();
     if (satp >> 31) {
         int32_t page_table_addr = mem_page_table_addr(satp & MASK(22));
         if (!page_table_addr)
@@ -157,12 +232,14 @@ static void mmu_set(vm_t *vm, uint32_t satp)
         satp = 0;
     }
     vm->satp = satp;
+    mmu_select(vm);
 }
 
 
 #define PTE_ITER(ptea, vpn, additional_checks)          \
     *ptea += 4*((vpn));                                 \
-    vm->mem_fetch(vm, *ptea, pte);                      \
+    if (!bus_load_pte(vm, *ptea, pte))                  \
+        return false;                                   \
     switch ((*pte) & MASK(4)) {                         \
     case 0b0001:                                        \
         break; /* pointer to next level */              \
@@ -180,7 +257,7 @@ static void mmu_set(vm_t *vm, uint32_t satp)
         return true; /* not valid */                    \
     }
 
-/* Assume vm->page_table is set.
+/* Assume vm->page_table_addr is set.
  *
  * If there is an error fetching a page table, return false.
  * Otherwise return true and:
@@ -217,8 +294,6 @@ static void mmu_translate(vm_t *vm,
     (void)set_bits;
     /* NOTE: save virtual address, for physical accesses, to set exception. */
     vm->exc_val = *addr;
-    if (!vm->page_table_addr)
-        return;
 
     int32_t ptea;
     uint32_t pte;
@@ -248,7 +323,7 @@ static void mmu_translate(vm_t *vm,
 /*
     uint32_t new_pte = pte | set_bits;
     if (new_pte != pte)
-        vm->mem_store(vm, vm->page_table_addr, RV_MEM_SW, new_pte);
+        bus_store(vm, vm->page_table_addr, RV_MEM_SW, new_pte);
 */
     *addr = ((*addr) & MASK(RV_PAGE_SHIFT)) | (ppn << RV_PAGE_SHIFT);
 }
@@ -258,89 +333,385 @@ static void mmu_fence(vm_t *vm UNUSED, uint32_t insn UNUSED)
     mmu_fetch_cache_valid = false;
     mmu_load_cache_valid = false;
     mmu_store_cache_valid = false;
+    decode_cache_flush();
+    jit_unlink();
+}
+
+/* Memory access paths
+ *
+ * The fetch, load and store paths come in a copy for the MMU being off and
+ * one for Sv32. mmu_select() points mmu_fetch_translate, mmu_load and
+ * mmu_store at the copies for the current satp, and works out the
+ * permissions that the privilege level and sstatus give to the Sv32 ones.
+ * It runs wherever those change, in mmu_set(), vm_trap(), op_sret() and
+ * sstatus writes, so that an access tests none of them itself.
+ */
+
+/* access bits a load needs in its leaf PTE, with MXR executable pages too */
+static uint32_t mmu_load_access;
+
+/* whether a load or store may access U-mode pages from S-mode (SUM) */
+static bool mmu_sum;
+
+/* Translate the fetch address *addr to a physical one. Returns false if that
+ * failed (vm->error is set).
+ */
+static bool mmu_fetch_translate_bare(vm_t *vm UNUSED, uint32_t *addr UNUSED)
+{
+    return true;
 }
 
-static void mmu_fetch(vm_t *vm, uint32_t addr, uint32_t *value)
+static bool mmu_fetch_translate_sv32(vm_t *vm, uint32_t *addr)
 {
     static uint32_t addr_from, addr_to;
-    const uint32_t pagepart = addr & ~MASK(RV_PAGE_SHIFT);
+    const uint32_t pagepart = *addr & ~MASK(RV_PAGE_SHIFT);
     if (mmu_fetch_cache_valid && pagepart == addr_from) {
-        addr=(addr_to | (addr & MASK(RV_PAGE_SHIFT)));
+        *addr = (addr_to | (*addr & MASK(RV_PAGE_SHIFT)));
     } else {
         mmu_fetch_cache_valid = false;
-        addr_from = addr & ~MASK(RV_PAGE_SHIFT);
-        mmu_translate(vm, &addr, (1 << 3), (1 << 6), false, RV_EXC_FETCH_FAULT,
+        addr_from = pagepart;
+        mmu_translate(vm, addr, (1 << 3), (1 << 6), false, RV_EXC_FETCH_FAULT,
                       RV_EXC_FETCH_PFAULT);
-        if (vm->error)
-            return;
+        if (vm_faulted(vm))
+            return false;
         mmu_fetch_cache_valid = true;
-        addr_to = addr & ~MASK(RV_PAGE_SHIFT);
+        addr_to = *addr & ~MASK(RV_PAGE_SHIFT);
     }
-    vm->mem_fetch(vm, addr, value);
+    return true;
+}
+
+static bool (*mmu_fetch_translate)(vm_t *vm,
+                                   uint32_t *addr) = mmu_fetch_translate_bare;
+
+#if SEMU_HAS(RVC)
+/* Complete the 32-bit instruction whose lower half is the upper halfword of
+ * the word at the physical address addr. Its upper half is in the next word,
+ * which may be in the next page, and is translated from vm->pc then. As
+ * that mapping can change independently, such an instruction goes to a
+ * scratch entry instead of the cache slot d. Returns the entry to decode
+ * into, NULL if the fetch failed (vm->error is set).
+ */
+static decoded_insn_t *mmu_fetch_upper(vm_t *vm,
+                                       uint32_t addr,
+                                       decoded_insn_t *d,
+                                       uint32_t *insn)
+{
+    static decoded_insn_t crossing;
+    uint32_t next = addr + 2, upper = 0;
+
+    if (unlikely(!(next & MASK(RV_PAGE_SHIFT)))) {
+        next = vm->pc + 2;
+        if (!mmu_fetch_translate(vm, &next))
+            return NULL;
+        d = &crossing;
+    }
+    bus_fetch(vm, next, &upper);
+    if (vm_faulted(vm))
+        return NULL;
+    *insn |= upper << 16;
+    return d;
+}
+#endif
+
+/* Fetch and decode the instruction at vm->pc, whose physical address is addr.
+ * Returns NULL if the fetch failed (vm->error is set).
+ */
+static const decoded_insn_t *mmu_fetch(vm_t *vm, uint32_t addr)
+{
+    decoded_insn_t *d = decode_cache_slot(addr);
+    if (likely(d->tag == (addr | 1)))
+        return d;
+    uint32_t insn = 0;
+    vm->exc_val = vm->pc; /* for a fault raised by bus_fetch() */
+    bus_fetch(vm, addr, &insn);
+    if (vm_faulted(vm))
+        return NULL;
+#if SEMU_HAS(RVC)
+    if (addr & 0b10) {
+        insn >>= 16;
+        if ((insn & 0b11) == 0b11 && !(d = mmu_fetch_upper(vm, addr, d, &insn)))
+            return NULL;
+        decode_insn(d, insn);
+        decode_pseudo(d);
+        d->tag = addr | 1;
+        return d;
+    }
+#endif
+    decode_insn(d, insn);
+    decode_pseudo(d);
+#if SEMU_HAS(FUSE)
+    /* pairs are only fused within a page, where the second word is known to
+     * be fetchable as well
+     */
+    if ((d->op == OP_LUI || d->op == OP_AUIPC || d->op == OP_SLLI) &&
+        ((addr + 4) & MASK(RV_PAGE_SHIFT))) {
+        bus_fetch(vm, addr + 4, &insn);
+        decode_fuse(d, insn);
+    }
+#endif
+    d->tag = addr | 1;
+    return d;
 }
 
+/* The first half of a fused pair alone, for when the second one must not run
+ * in the same step.
+ */
+static const decoded_insn_t *decode_unfuse(const decoded_insn_t *d)
+{
+    static decoded_insn_t first;
+
+    decode_insn(&first, d->insn);
+    decode_pseudo(&first);
+    return &first;
+}
+
+/* Drop what was translated from the code a store of width at addr changes.
+ * With MISALIGNED, the store may reach into the next word.
+ */
+static inline void mmu_store_snoop(uint32_t addr, uint8_t width)
+{
+    decode_cache_snoop(addr);
+#if SEMU_HAS(MISALIGNED)
+    if (unlikely((addr & 0b11) + (1 << (width & 0b11)) > 4))
+        decode_cache_snoop(addr + 4);
+#else
+    (void) width;
+#endif
+    jit_snoop(addr);
+    aot_snoop(addr);
+}
+
+/* Check for a store to addr breaking the reservation of an LR, or if cond,
+ * whether the SC to addr has one. Returns false if the store must not be
+ * made then.
+ */
+static inline bool mmu_store_reserve(vm_t *vm, uint32_t addr, bool cond)
+{
+    if (unlikely(cond)) {
+        if (vm->lr_reservation != (addr | 1))
+            return false;
+        vm->lr_reservation = 0;
+    } else {
+        if (unlikely(vm->lr_reservation & 1) &&
+            (vm->lr_reservation & ~3) == (addr & ~3))
+            vm->lr_reservation = 0;
+    }
+    return true;
+}
+
+/* Load width bytes at the virtual address addr into *value, and reserve addr
+ * for an SC if reserved. vm->exc_val is addr for a fault bus_load() raises.
+ */
 __attribute__((nonreentrant))
-static void mmu_load(vm_t *vm,
-                     uint32_t addr,
-                     uint8_t width,
-                     uint32_t *value,
-                     bool reserved)
+static void mmu_load_bare(vm_t *vm,
+                          uint32_t addr,
+                          uint8_t width,
+                          uint32_t *value,
+                          bool reserved)
+{
+    vm->exc_val = addr;
+    if (unlikely(addr >= RAM_SIZE))
+        run_reason = VM_RUN_MMIO;
+    bus_load(vm, addr, width, value);
+    if (vm_faulted(vm))
+        return;
+
+    if (unlikely(reserved))
+        vm->lr_reservation = addr | 1;
+}
+
+__attribute__((nonreentrant))
+static void mmu_load_sv32(vm_t *vm,
+                          uint32_t addr,
+                          uint8_t width,
+                          uint32_t *value,
+                          bool reserved)
 {
-    static uint32_t addr_from, addr_to;
     const uint32_t pagepart = addr & ~MASK(RV_PAGE_SHIFT);
-    if (mmu_load_cache_valid && pagepart == addr_from) {
-        addr=(addr_to | (addr & MASK(RV_PAGE_SHIFT)));
+    vm->exc_val = addr;
+    if (mmu_load_cache_valid && pagepart == mmu_load_from) {
+        addr=(mmu_load_to | (addr & MASK(RV_PAGE_SHIFT)));
     } else {
         mmu_load_cache_valid = false;
-        addr_from = addr & ~MASK(RV_PAGE_SHIFT);
-        mmu_translate(vm, &addr, (1 << 1) | (vm->sstatus_mxr ? (1 << 3) : 0),
-                      (1 << 6), vm->sstatus_sum && vm->s_mode, RV_EXC_LOAD_FAULT,
-                      RV_EXC_LOAD_PFAULT);
-        if (vm->error)
+        mmu_load_from = addr & ~MASK(RV_PAGE_SHIFT);
+        mmu_translate(vm, &addr, mmu_load_access, (1 << 6), mmu_sum,
+                      RV_EXC_LOAD_FAULT, RV_EXC_LOAD_PFAULT);
+        if (vm_faulted(vm))
             return;
         mmu_load_cache_valid = true;
-        addr_to = addr & ~MASK(RV_PAGE_SHIFT);
+        mmu_load_to = addr & ~MASK(RV_PAGE_SHIFT);
     }
-    vm->mem_load(vm, addr, width, value);
-    if (vm->error)
+    if (unlikely(addr >= RAM_SIZE))
+        run_reason = VM_RUN_MMIO;
+    bus_load(vm, addr, width, value);
+    if (vm_faulted(vm))
         return;
 
     if (unlikely(reserved))
         vm->lr_reservation = addr | 1;
 }
 
-static bool mmu_store(vm_t *vm,
-                      uint32_t addr,
-                      uint8_t width,
-                      uint32_t value,
-                      bool cond)
+static void (*mmu_load)(vm_t *vm,
+                        uint32_t addr,
+                        uint8_t width,
+                        uint32_t *value,
+                        bool reserved) = mmu_load_bare;
+
+/* Store the width low bytes of value at the virtual address addr. If cond,
+ * that is an SC, which is only made if it has a reservation. Returns whether
+ * the store was made, vm->exc_val is addr for a fault bus_store() raises.
+ */
+static bool mmu_store_bare(vm_t *vm,
+                           uint32_t addr,
+                           uint8_t width,
+                           uint32_t value,
+                           bool cond)
+{
+    vm->exc_val = addr;
+    if (unlikely(addr >= RAM_SIZE))
+        run_reason = VM_RUN_MMIO;
+    mmu_store_snoop(addr, width);
+    if (!mmu_store_reserve(vm, addr, cond))
+        return false;
+    bus_store(vm, addr, width, value);
+    return true;
+}
+
+static bool mmu_store_sv32(vm_t *vm,
+                           uint32_t addr,
+                           uint8_t width,
+                           uint32_t value,
+                           bool cond)
 {
-    static uint32_t addr_from, addr_to;
     const uint32_t pagepart = addr & ~MASK(RV_PAGE_SHIFT);
-    if (mmu_store_cache_valid && pagepart == addr_from) {
-        addr=(addr_to | (addr & MASK(RV_PAGE_SHIFT)));
+    vm->exc_val = addr;
+    if (mmu_store_cache_valid && pagepart == mmu_store_from) {
+        addr=(mmu_store_to | (addr & MASK(RV_PAGE_SHIFT)));
     } else {
         mmu_store_cache_valid = false;
-        addr_from = addr & ~MASK(RV_PAGE_SHIFT);
-        mmu_translate(vm, &addr, (1 << 2), (1 << 6) | (1 << 7),
-                      vm->sstatus_sum && vm->s_mode, RV_EXC_STORE_FAULT,
-                      RV_EXC_STORE_PFAULT);
-        if (vm->error)
+        mmu_store_from = addr & ~MASK(RV_PAGE_SHIFT);
+        mmu_translate(vm, &addr, (1 << 2), (1 << 6) | (1 << 7), mmu_sum,
+                      RV_EXC_STORE_FAULT, RV_EXC_STORE_PFAULT);
+        if (vm_faulted(vm))
             return false;
         mmu_store_cache_valid = true;
-        addr_to = addr & ~MASK(RV_PAGE_SHIFT);
+        mmu_store_to = addr & ~MASK(RV_PAGE_SHIFT);
     }
-    if (unlikely(cond)) {
-        if (vm->lr_reservation != (addr | 1))
-            return false;
+    if (unlikely(addr >= RAM_SIZE))
+        run_reason = VM_RUN_MMIO;
+    mmu_store_snoop(addr, width);
+    if (!mmu_store_reserve(vm, addr, cond))
+        return false;
+    bus_store(vm, addr, width, value);
+    return true;
+}
+
+static bool (*mmu_store)(vm_t *vm,
+                         uint32_t addr,
+                         uint8_t width,
+                         uint32_t value,
+                         bool cond) = mmu_store_bare;
+
+#if SEMU_HAS(ASM_CORE) && SEMU_HAS(STATIC_BUS)
+/* RAM ends where the address leaves the low three bytes */
+_Static_assert(RAM_SIZE == 1UL << 24, "asm_core.S");
+
+void asm_store_word(uint32_t addr, uint32_t value)
+{
+    mmu_store_snoop(addr, RV_MEM_SW);
+    saveword_reu(addr, value);
+}
+#endif
+
+/* Pick the access paths for the current satp, privilege level and sstatus */
+static void mmu_select(vm_t *vm)
+{
+    mmu_paging = vm->page_table_addr != 0;
+    if (!mmu_paging) {
+        mmu_fetch_translate = mmu_fetch_translate_bare;
+        mmu_load = mmu_load_bare;
+        mmu_store = mmu_store_bare;
+        return;
+    }
+    mmu_fetch_translate = mmu_fetch_translate_sv32;
+    mmu_load = mmu_load_sv32;
+    mmu_store = mmu_store_sv32;
+    mmu_load_access = (1 << 1) | (vm_sstatus(vm, MXR) ? (1 << 3) : 0);
+    mmu_sum = vm_sstatus(vm, SUM) && vm->s_mode;
+}
+
+/* Zero the cbo.zero block at the virtual address addr, which has to be
+ * aligned, in a single bus_zero() if the bus can do that.
+ */
+static void mmu_zero(vm_t *vm, uint32_t addr)
+{
+    vm->exc_val = addr;
+    if (vm->page_table_addr) {
+        mmu_translate(vm, &addr, (1 << 2), (1 << 6) | (1 << 7), mmu_sum,
+                      RV_EXC_STORE_FAULT, RV_EXC_STORE_PFAULT);
+        if (vm_faulted(vm))
+            return;
+    }
+    if (unlikely(addr >= RAM_SIZE))
+        run_reason = VM_RUN_MMIO;
+    /* the block does not cross a page */
+    decode_cache_snoop_block(addr, RV_CBOZ_BLOCK_SIZE);
+    jit_snoop(addr);
+    aot_snoop(addr);
+    if (unlikely(vm->lr_reservation & 1) &&
+        (vm->lr_reservation & ~(RV_CBOZ_BLOCK_SIZE - 1)) == addr)
         vm->lr_reservation = 0;
-    } else {
-        if (unlikely(vm->lr_reservation & 1) &&
-            (vm->lr_reservation & ~3) == (addr & ~3))
-            vm->lr_reservation = 0;
+
+    if (bus_zero(vm, addr, RV_CBOZ_BLOCK_SIZE))
+        return;
+    for (uint16_t i = 0; i < RV_CBOZ_BLOCK_SIZE && !vm_faulted(vm); i += 4)
+        bus_store(vm, addr + i, RV_MEM_SW, 0);
+}
+
+/* Whether a load or store of width at addr continues in the next page. With
+ * MISALIGNED, such an access goes byte by byte through mmu_load_split() or
+ * mmu_store_split(), so that each page is translated on its own, and the
+ * memory callbacks only see misaligned accesses within a page.
+ */
+static inline bool mmu_straddles(uint32_t addr, uint8_t width)
+{
+    return SEMU_HAS(MISALIGNED) &&
+           unlikely((addr & MASK(RV_PAGE_SHIFT)) >
+                    (uint32_t) (RV_PAGE_SIZE - (1 << (width & 0b11))));
+}
+
+static void mmu_load_split(vm_t *vm,
+                           uint32_t addr,
+                           uint8_t width,
+                           uint32_t *value)
+{
+    uint32_t x = 0, byte;
+
+#if SEMU_HAS(MISALIGNED)
+    ram_misaligned++;
+#endif
+    for (uint8_t i = 0; i < 1 << (width & 0b11); i++) {
+        mmu_load(vm, addr + i, RV_MEM_LBU, &byte, false);
+        if (vm_faulted(vm))
+            return;
+        x |= byte << (i * 8);
+    }
+    *value = width == RV_MEM_LH ? (uint32_t) (int32_t) (int16_t) x : x;
+}
+
+static void mmu_store_split(vm_t *vm,
+                            uint32_t addr,
+                            uint8_t width,
+                            uint32_t value)
+{
+#if SEMU_HAS(MISALIGNED)
+    ram_misaligned++;
+#endif
+    for (uint8_t i = 0; i < 1 << (width & 0b11); i++) {
+        mmu_store(vm, addr + i, RV_MEM_SB, value >> (i * 8), false);
+        if (vm_faulted(vm))
+            return;
     }
-    vm->mem_store(vm, addr, width, value);
-    return true;
 }
 
 /* exceptions, traps, interrupts */
@@ -350,6 +721,35 @@ void vm_set_exception(vm_t *vm, uint32_t cause, uint32_t val)
     vm->error = ERR_EXCEPTION;
     vm->exc_cause = cause;
     vm->exc_val = val;
+#if SEMU_HAS(UNWIND)
+    if (unwind_armed)
+        longjmp(unwind_point, 1);
+#endif
+}
+
+/* highest set bit of a nibble */
+static const uint8_t nibble_msb[16] = {0, 0, 1, 1, 2, 2, 2, 2,
+                                       3, 3, 3, 3, 3, 3, 3, 3};
+
+void vm_update_irq(vm_t *vm)
+{
+    /* only the bits of SIE_MASK can be both pending and enabled */
+    uint16_t pending = vm->sip & vm->sie;
+    uint8_t idx = 1;
+
+    if (!pending || !(vm_sstatus(vm, SIE) || !vm->s_mode)) {
+        vm->irq = 0;
+        return;
+    }
+    if (pending >> 8) {
+        pending >>= 8;
+        idx += 8;
+    }
+    if (pending >> 4) {
+        pending >>= 4;
+        idx += 4;
+    }
+    vm->irq = idx + nibble_msb[pending];
 }
 
 void vm_trap(vm_t *vm)
@@ -359,30 +759,41 @@ void vm_trap(vm_t *vm)
     vm->stval = vm->exc_val;
 
     /* Save to stack */
-    vm->sstatus_spie = vm->sstatus_sie;
-    vm->sstatus_spp = vm->s_mode;
+    vm_sstatus_clear(vm, SPIE);
+    if (vm_sstatus(vm, SIE))
+        vm_sstatus_set(vm, SPIE);
+    vm_sstatus_clear(vm, SPP);
+    if (vm->s_mode)
+        vm_sstatus_set(vm, SPP);
     vm->sepc = vm->current_pc;
 
     /* Set */
-    vm->sstatus_sie = false;
+    vm_sstatus_clear(vm, SIE);
     vm->s_mode = true;
     vm->pc = vm->stvec_addr;
     if (vm->stvec_vectored)
         vm->pc += (vm->scause & MASK(31)) * 4;
 
     vm->error = ERR_NONE;
+    vm_update_irq(vm);
+    mmu_select(vm);
 }
 
 static void op_sret(vm_t *vm)
 {
     /* Restore from stack */
     vm->pc = vm->sepc;
-    vm->s_mode = vm->sstatus_spp;
-    vm->sstatus_sie = vm->sstatus_spie;
+    run_reason = VM_RUN_BRANCH;
+    vm->s_mode = vm_sstatus(vm, SPP);
+    vm_sstatus_clear(vm, SIE);
+    if (vm_sstatus(vm, SPIE))
+        vm_sstatus_set(vm, SIE);
 
     /* Reset stack */
-    vm->sstatus_spp = false;
-    vm->sstatus_spie = true;
+    vm_sstatus_clear(vm, SPP);
+    vm_sstatus_set(vm, SPIE);
+    vm_update_irq(vm);
+    mmu_select(vm);
 }
 
 static void op_privileged(vm_t *vm, uint32_t insn)
@@ -406,7 +817,9 @@ static void op_privileged(vm_t *vm, uint32_t insn)
         op_sret(vm);
         break;
     case 0b000100000101: /* PRIV_WFI */
-                         /* TODO: Implement this */
+        /* a no-op, but the environment may skip ahead to the next interrupt */
+        if (!(vm->sip & vm->sie))
+            run_reason = VM_RUN_WFI;
         break;
     default:
         vm_set_exception(vm, RV_EXC_ILLEGAL_INSTR, 0);
@@ -416,18 +829,301 @@ static void op_privileged(vm_t *vm, uint32_t insn)
 
 /* CSR instructions */
 
+static inline void set_rd(vm_t *vm, uint8_t rd, uint32_t x)
+{
+    vm_set_reg(vm, rd, x);
+}
+
 static inline void set_dest(vm_t *vm, uint32_t insn, uint32_t x)
 {
-    uint8_t rd = decode_rd(insn);
-    if (rd)
-        vm->x_regs[rd] = x;
+    set_rd(vm, decode_rd(insn), x);
 }
 
 /* clang-format off */
 #define SIE_MASK (RV_INT_SEI_BIT | RV_INT_STI_BIT | RV_INT_SSI_BIT)
+#define SSTATUS_MASK                                                    \
+    (1UL << VM_SSTATUS_SIE | 1UL << VM_SSTATUS_SPIE |                   \
+     1UL << VM_SSTATUS_SPP | 1UL << VM_SSTATUS_SUM | 1UL << VM_SSTATUS_MXR)
 #define SIP_MASK (0              | 0              | RV_INT_SSI_BIT)
 /* clang-format on */
 
+/* Delay loops
+ *
+ * udelay() and friends spin on a counter CSR until it has moved far enough:
+ *
+ *     1:  rdtime a5
+ *         sub a5, a5, a4
+ *         bltu a5, a0, 1b
+ *
+ * If a counter read is part of such a short loop, with everything else in it
+ * register-only and nothing carried over from one round to the next but the
+ * counter, every round before the last one only burns instructions. The read
+ * then skips whole rounds: it returns the count of a later round and takes
+ * their instructions from the budget, as far as the slice has room for that
+ * round to finish. No interrupt can come in between, so the count and state
+ * at the end of the slice are the same as if the rounds had run.
+ */
+
+#define DELAY_MAX_LEN 8 /* instructions per round */
+
+enum {
+    DELAY_UNSET,   /**< written later in the round, would be carried over */
+    DELAY_KNOWN,   /**< the same in every round, in value */
+    DELAY_UNKNOWN, /**< anything else */
+    DELAY_COUNTER, /**< sign * count + value */
+};
+
+typedef struct {
+    uint8_t kind;
+    int8_t sign;
+    uint32_t value;
+} delay_reg_t;
+
+/* Whether d has no effect besides setting rd, sets the registers it reads */
+static bool delay_pure(const decoded_insn_t *d, uint8_t *rs1, uint8_t *rs2)
+{
+    *rs1 = *rs2 = 0;
+    if (d->op >= OP_ADDI && d->op <= OP_SRAI) {
+        *rs1 = d->rs1;
+        return true;
+    }
+    if (d->op >= OP_ADD && d->op <= OP_MULDIV) {
+        /* the div of cpu_relax() is by x0, which gives -1 whatever rs1 is */
+        if (d->op != OP_MULDIV || d->rs2 ||
+            (decode_func3(d->insn) & 0b110) != 0b100)
+            *rs1 = d->rs1;
+        *rs2 = d->rs2;
+        return true;
+    }
+    return d->op == OP_LUI || d->op == OP_AUIPC || d->op == OP_FENCE;
+}
+
+static void delay_eval(const decoded_insn_t *d,
+                       const delay_reg_t *a,
+                       const delay_reg_t *b,
+                       delay_reg_t *out)
+{
+    out->kind = DELAY_UNKNOWN;
+    out->sign = a->sign;
+    switch (d->op) {
+    case OP_ADDI:
+        if (a->kind == DELAY_KNOWN || a->kind == DELAY_COUNTER) {
+            out->kind = a->kind;
+            out->value = a->value + d->imm;
+        }
+        break;
+    case OP_ADD:
+        if (a->kind == DELAY_COUNTER && b->kind == DELAY_KNOWN)
+            *out = *a;
+        else if (a->kind == DELAY_KNOWN && b->kind == DELAY_COUNTER)
+            *out = *b;
+        else if (a->kind != DELAY_KNOWN || b->kind != DELAY_KNOWN)
+            break;
+        out->value = a->value + b->value;
+        break;
+    case OP_SUB:
+        if (b->kind == DELAY_COUNTER && a->kind == DELAY_KNOWN) {
+            out->kind = DELAY_COUNTER;
+            out->sign = -b->sign;
+        } else if (b->kind != DELAY_KNOWN ||
+                   (a->kind != DELAY_KNOWN && a->kind != DELAY_COUNTER))
+            break;
+        else
+            out->kind = a->kind;
+        out->value = a->value - b->value;
+        break;
+    case OP_LUI:
+        out->kind = DELAY_KNOWN;
+        out->value = d->imm;
+        break;
+    case OP_MULDIV:
+        if (!d->rs2 && (decode_func3(d->insn) & 0b110) == 0b100) {
+            out->kind = DELAY_KNOWN;
+            out->value = 0xFFFFFFFF;
+        }
+        break;
+    }
+}
+
+/* Decode the instruction at the physical address addr, in the page being
+ * executed from, afresh. Going through mmu_fetch() could evict the one being
+ * executed. Returns its length, zero if it does not end within the page or
+ * is not in RAM. This runs within a counter read, which must not raise a
+ * fetch fault, so the skip is given up rather than fetching outside of RAM.
+ */
+static uint8_t delay_fetch(vm_t *vm, uint32_t addr, decoded_insn_t *d)
+{
+    uint32_t insn = 0;
+    if (addr >= RAM_SIZE)
+        return 0;
+    bus_fetch(vm, addr, &insn);
+    if (vm_faulted(vm))
+        return 0;
+#if SEMU_HAS(RVC)
+    if (addr & 0b10) {
+        insn >>= 16;
+        if ((insn & 0b11) == 0b11) {
+            uint32_t upper = 0;
+            if (!((addr + 2) & MASK(RV_PAGE_SHIFT)))
+                return 0;
+            bus_fetch(vm, addr + 2, &upper);
+            if (vm_faulted(vm))
+                return 0;
+            insn |= upper << 16;
+        }
+    }
+#endif
+    decode_insn(d, insn);
+    return decode_len(d);
+}
+
+/* Called from a counter read, after vm_retire() */
+static void delay_skip(vm_t *vm)
+{
+    static decoded_insn_t loop[DELAY_MAX_LEN];
+    static delay_reg_t r[32];
+    static uint32_t before[DELAY_MAX_LEN]; /* rd of loop[] at the read */
+    const uint32_t pc = vm->current_pc;
+    uint32_t phys = pc, at;
+    uint8_t n, len, pos, size;
+
+    if (!mmu_fetch_translate(vm, &phys))
+        return;
+
+    /* the loop branch follows the read within the page */
+    at = phys;
+    for (n = 0; n < DELAY_MAX_LEN; n++) {
+        if (!(size = delay_fetch(vm, at, &loop[0])))
+            return;
+        if (n && loop[0].op >= OP_BEQ && loop[0].op <= OP_BGEU)
+            break;
+        at += size;
+        if (!(at & MASK(RV_PAGE_SHIFT)))
+            return;
+    }
+    /* and jumps back to the start of the loop, at or before the read */
+    const uint32_t branch = at, start = at + loop[0].imm;
+    if (n == DELAY_MAX_LEN || start > phys ||
+        phys - start > (phys & MASK(RV_PAGE_SHIFT)))
+        return;
+    pos = DELAY_MAX_LEN;
+    for (len = 0, at = start; at != branch; len++, at += size) {
+        if (len == DELAY_MAX_LEN - 1 || at > branch)
+            return;
+        if (at == phys)
+            pos = len;
+        if (!(size = delay_fetch(vm, at, &loop[len])))
+            return;
+    }
+    if (pos == DELAY_MAX_LEN)
+        return;
+    delay_fetch(vm, branch, &loop[len++]);
+
+    const decoded_insn_t *read = &loop[pos];
+    if ((decode_func3(read->insn) & 0b010) != 0b010 || read->rs1 ||
+        !read->rd)
+        return;
+
+    /* registers are known before they are written, unless that happens
+     * later in the round, and nothing else has side effects
+     */
+    uint32_t written = 0;
+    for (uint8_t i = 0; i < len - 1; i++) {
+        uint8_t rs1, rs2;
+        if (i != pos && !delay_pure(&loop[i], &rs1, &rs2))
+            return;
+        if (loop[i].op == OP_FENCE)
+            loop[i].rd = 0;
+        written |= 1UL << loop[i].rd;
+    }
+    for (uint8_t i = 0; i < 32; i++) {
+        r[i].kind = (written >> i) & 1 ? DELAY_UNSET : DELAY_KNOWN;
+        r[i].value = vm_get_reg(vm, i);
+    }
+    r[0].kind = DELAY_KNOWN;
+    for (uint8_t i = 0; i < len - 1; i++) {
+        const decoded_insn_t *d = &loop[i];
+        uint8_t rs1, rs2;
+        delay_reg_t v;
+        if (i == pos) {
+            /* the round the read is in may have been entered after the
+             * instructions before it, which a skipped round would have run
+             */
+            for (uint8_t k = 0; k < pos; k++) {
+                if (r[loop[k].rd].kind != DELAY_KNOWN)
+                    return;
+                before[k] = r[loop[k].rd].value;
+            }
+            v.kind = DELAY_COUNTER;
+            v.sign = 1;
+            v.value = 0;
+        } else {
+            delay_pure(d, &rs1, &rs2);
+            if (r[rs1].kind == DELAY_UNSET || r[rs2].kind == DELAY_UNSET)
+                return;
+            delay_eval(d, &r[rs1], &r[rs2], &v);
+        }
+        if (d->rd)
+            r[d->rd] = v;
+    }
+
+    /* the branch back is taken while the counter term is on one side of a
+     * bound, which it has to reach without wrapping around
+     */
+    const decoded_insn_t *br = &loop[len - 1];
+    const bool first = r[br->rs1].kind == DELAY_COUNTER;
+    const delay_reg_t *c = first ? &r[br->rs1] : &r[br->rs2];
+    const delay_reg_t *b = first ? &r[br->rs2] : &r[br->rs1];
+    if (c->kind != DELAY_COUNTER || b->kind != DELAY_KNOWN)
+        return;
+    uint32_t now = c->value + (c->sign > 0 ? vm->insn_count : -vm->insn_count);
+    uint32_t bound = b->value;
+    if (br->op == OP_BLT || br->op == OP_BGE) {
+        now ^= 1UL << 31;
+        bound ^= 1UL << 31;
+    }
+    const bool lt = br->op == OP_BLT || br->op == OP_BLTU;
+    uint32_t rounds;
+    if (br->op == OP_BEQ || br->op == OP_BNE) {
+        return;
+    } else if (c->sign > 0 && lt == first) {
+        /* counting up while now < bound, or now <= bound */
+        if (lt && !bound--)
+            return;
+        if (now > bound)
+            return;
+        const uint32_t rest = (bound - now) % len;
+        if (bound - rest > 0xFFFFFFFF - len)
+            return;
+        rounds = (bound - now) / len + 1;
+    } else if (c->sign < 0 && lt != first) {
+        /* counting down while now > bound, or now >= bound */
+        if (lt && !++bound)
+            return;
+        if (now < bound)
+            return;
+        const uint32_t rest = (now - bound) % len;
+        if (bound + rest < len)
+            return;
+        rounds = (now - bound) / len + 1;
+    } else {
+        return;
+    }
+
+    /* whole rounds, with room left to finish the last one */
+    const uint8_t tail = len - 1 - pos;
+    if (slice_left < tail)
+        return;
+    if (rounds > (uint16_t) (slice_left - tail) / len)
+        rounds = (uint16_t) (slice_left - tail) / len;
+    if (!rounds)
+        return;
+    for (uint8_t k = 0; k < pos; k++)
+        vm_set_reg(vm, loop[k].rd, before[k]);
+    slice_left -= (uint16_t) rounds * len;
+    vm_retire(vm);
+}
+
 static void csr_read(vm_t *vm, uint16_t addr, uint32_t *value)
 {
     if ((addr >> 8) == 0xC) {
@@ -440,6 +1136,9 @@ static void csr_read(vm_t *vm, uint16_t addr, uint32_t *value)
              * and writes should set the value after the increment. However,
              * we do not expose any way to write the counters.
              */
+            vm_retire(vm);
+            if (!(addr & (1 << 7)) && slice_left)
+                delay_skip(vm);
             *value = (addr & (1 << 7)) ? vm->insn_count_hi : vm->insn_count;
         }
         return;
@@ -452,12 +1151,7 @@ static void csr_read(vm_t *vm, uint16_t addr, uint32_t *value)
 
     switch (addr) {
     case RV_CSR_SSTATUS:
-        *value = 0;
-        vm->sstatus_sie && (*value |= 1 << (1));
-        vm->sstatus_spie && (*value |= 1 << (5));
-        vm->sstatus_spp && (*value |= 1 << (8));
-        vm->sstatus_sum && (*value |= 1UL << (18));
-        vm->sstatus_mxr && (*value |= 1UL << (19));
+        *value = vm->sstatus;
         break;
     case RV_CSR_SIE:
         *value = vm->sie;
@@ -476,6 +1170,9 @@ static void csr_read(vm_t *vm, uint16_t addr, uint32_t *value)
     case RV_CSR_SCOUNTEREN:
         *value = vm->scounteren;
         break;
+    case RV_CSR_SENVCFG:
+        *value = vm->senvcfg;
+        break;
     case RV_CSR_SSCRATCH:
         *value = vm->sscratch;
         break;
@@ -502,20 +1199,20 @@ static void csr_write(vm_t *vm, uint16_t addr, uint32_t value)
 
     switch (addr) {
     case RV_CSR_SSTATUS:
-        vm->sstatus_sie = (value & (1 << (1))) != 0;
-        vm->sstatus_spie = (value & (1 << (5))) != 0;
-        vm->sstatus_spp = (value & (1 << (8))) != 0;
-        vm->sstatus_sum = (value & (1UL << (18))) != 0;
-        vm->sstatus_mxr = (value & (1UL << (19))) != 0;
+        vm->sstatus = value & SSTATUS_MASK;
+        vm_update_irq(vm);
+        mmu_select(vm);
         break;
     case RV_CSR_SIE:
         value &= SIE_MASK;
         vm->sie = value;
+        vm_update_irq(vm);
         break;
     case RV_CSR_SIP:
         value &= SIP_MASK;
         value |= vm->sip & ~SIP_MASK;
         vm->sip = value;
+        vm_update_irq(vm);
         break;
     case RV_CSR_STVEC:
         vm->stvec_addr = value;
@@ -528,10 +1225,19 @@ static void csr_write(vm_t *vm, uint16_t addr, uint32_t value)
     case RV_CSR_SCOUNTEREN:
         vm->scounteren = value;
         break;
+    case RV_CSR_SENVCFG:
+        vm->senvcfg = value & RV_SENVCFG_CBZE;
+        break;
     case RV_CSR_SSCRATCH:
         vm->sscratch = value;
         break;
     case RV_CSR_SEPC:
+#if SEMU_HAS(RVC)
+        /* sepc[0] is hardwired to zero, the jump handlers of asm_core.S
+         * count on an even pc
+         */
+        value &= ~1;
+#endif
         vm->sepc = value;
         break;
     case RV_CSR_SCAUSE:
@@ -550,7 +1256,7 @@ static void op_csr_rw(vm_t *vm, uint32_t insn, uint16_t csr, uint32_t wvalue)
     if (decode_rd(insn)) {
         uint32_t value;
         csr_read(vm, csr, &value);
-        if (unlikely(vm->error))
+        if (vm_faulted(vm))
             return;
         set_dest(vm, insn, value);
     }
@@ -565,7 +1271,7 @@ static void op_csr_cs(vm_t *vm,
 {
     uint32_t value;
     csr_read(vm, csr, &value);
-    if (unlikely(vm->error))
+    if (vm_faulted(vm))
         return;
     set_dest(vm, insn, value);
     if (decode_rs1(insn))
@@ -611,106 +1317,82 @@ static void op_system(vm_t *vm, uint32_t insn)
 static uint32_t op_mul(uint32_t insn, uint32_t a, uint32_t b)
 {
     /* TODO: Test ifunc7 zeros */
+    uint32_t hi, rem, q;
     switch (decode_func3(insn)) {
     case 0b000: /* MUL */
-        return a * b;
-    case 0b001: { /* MULH */
-        const int64_t _a = (int32_t) a;
-        const int64_t _b = (int32_t) b;
-        return ((uint64_t) (_a * _b)) >> 32;
-    }
-    case 0b010: { /* MULHSU */
-        const int64_t _a = (int32_t) a;
-        const uint64_t _b = b;
-        return ((uint64_t) (_a * _b)) >> 32;
-    }
+        return mul32(a, b, NULL);
+    case 0b001: /* MULH */
+        /* the signed product is the unsigned one less b or a times 2^32 for
+         * each negative operand a or b
+         */
+        mul32(a, b, &hi);
+        return hi - ((int32_t) a < 0 ? b : 0) - ((int32_t) b < 0 ? a : 0);
+    case 0b010: /* MULHSU */
+        mul32(a, b, &hi);
+        return hi - ((int32_t) a < 0 ? b : 0);
     case 0b011: /* MULHU */
-        return (uint32_t) ((((uint64_t) a) * ((uint64_t) b)) >> 32);
+        mul32(a, b, &hi);
+        return hi;
     case 0b100: /* DIV */
-        return b ? (uint32_t) (((int32_t) a) / ((int32_t) b)) : 0xFFFFFFFF;
+        if (!b)
+            return 0xFFFFFFFF;
+        /* on magnitudes, which also gives -2^31 for -2^31 / -1 */
+        q = divu32((int32_t) a < 0 ? -a : a, (int32_t) b < 0 ? -b : b, &rem);
+        return (int32_t) (a ^ b) < 0 ? -q : q;
     case 0b101: /* DIVU */
-        return b ? (a / b) : 0xFFFFFFFF;
+        return b ? divu32(a, b, &rem) : 0xFFFFFFFF;
     case 0b110: /* REM */
-        return b ? (uint32_t) (((int32_t) a) % ((int32_t) b)) : a;
+        if (!b)
+            return a;
+        divu32((int32_t) a < 0 ? -a : a, (int32_t) b < 0 ? -b : b, &rem);
+        return (int32_t) a < 0 ? -rem : rem;
     case 0b111: /* REMU */
-        return b ? (a % b) : a;
-    }
-    __builtin_unreachable();
-}
-
-#define NEG_BIT (insn & (1UL << 30))
-static uint32_t op_rv32i(uint32_t insn, bool is_reg, uint32_t a, uint32_t b)
-{
-    /* TODO: Test ifunc7 zeros */
-    switch (decode_func3(insn)) {
-    case 0b000: /* IFUNC_ADD */
-        return a + ((is_reg && NEG_BIT) ? -b : b);
-    case 0b010: /* IFUNC_SLT */
-        return ((int32_t) a) < ((int32_t) b);
-    case 0b011: /* IFUNC_SLTU */
-        return a < b;
-    case 0b100: /* IFUNC_XOR */
-        return a ^ b;
-    case 0b110: /* IFUNC_OR */
-        return a | b;
-    case 0b111: /* IFUNC_AND */
-        return a & b;
-    case 0b001: /* IFUNC_SLL */
-        return a << (b & MASK(5));
-    case 0b101: /* IFUNC_SRL */
-        return NEG_BIT ? (uint32_t) (((int32_t) a) >> (b & MASK(5))) /* SRA */
-                       : a >> (b & MASK(5)) /* SRL */;
+        if (!b)
+            return a;
+        divu32(a, b, &rem);
+        return rem;
     }
     __builtin_unreachable();
 }
-#undef NEG_BIT
 
-static bool op_jmp(vm_t *vm, uint32_t insn, uint32_t a, uint32_t b)
-{
-    switch (decode_func3(insn)) {
-    case 0b000: /* BFUNC_BEQ */
-        return a == b;
-    case 0b001: /* BFUNC_BNE */
-        return a != b;
-    case 0b110: /* BFUNC_BLTU */
-        return a < b;
-    case 0b111: /* BFUNC_BGEU */
-        return a >= b;
-    case 0b100: /* BFUNC_BLT */
-        return ((int32_t) a) < ((int32_t) b);
-    case 0b101: /* BFUNC_BGE */
-        return ((int32_t) a) >= ((int32_t) b);
-    }
-    vm_set_exception(vm, RV_EXC_ILLEGAL_INSTR, 0);
-    return false;
-}
+/* jump targets have to be word aligned, or halfword aligned with RVC */
+#if SEMU_HAS(RVC)
+#define PC_MISALIGNED(addr) ((addr) & 0b01)
+#else
+#define PC_MISALIGNED(addr) ((addr) & 0b11)
+#endif
 
 static void do_jump(vm_t *vm, uint32_t addr)
 {
-    if (unlikely(addr & 0b11))
+    if (unlikely(PC_MISALIGNED(addr))) {
         vm_set_exception(vm, RV_EXC_PC_MISALIGN, addr);
-    else
+    } else {
         vm->pc = addr;
+        run_reason = VM_RUN_BRANCH;
+    }
 }
 
-static void op_jump_link(vm_t *vm, uint32_t insn, uint32_t addr)
+static void op_jump_link(vm_t *vm, uint8_t rd, uint32_t addr)
 {
-    if (unlikely(addr & 0b11)) {
+    if (unlikely(PC_MISALIGNED(addr))) {
         vm_set_exception(vm, RV_EXC_PC_MISALIGN, addr);
     } else {
-        set_dest(vm, insn, vm->pc);
+        set_rd(vm, rd, vm->pc);
         vm->pc = addr;
+        run_reason = VM_RUN_BRANCH;
     }
 }
 
-#define AMO_OP(STORED_EXPR)                                   \
-    do {                                                      \
-        value2 = read_rs2(vm, insn);                          \
-        mmu_load(vm, addr, RV_MEM_LW, &value, false);         \
-        if (vm->error)                                        \
-            return;                                           \
-        set_dest(vm, insn, value);                            \
-        mmu_store(vm, addr, RV_MEM_SW, (STORED_EXPR), false); \
+#define AMO_OP(STORED_EXPR)                                           \
+    do {                                                              \
+        if (unlikely(addr & 0b11))                                    \
+            return vm_set_exception(vm, RV_EXC_STORE_MISALIGN, addr); \
+        value2 = read_rs2(vm, insn);                                  \
+        mmu_load(vm, addr, RV_MEM_LW, &value, false);                 \
+        if (vm_faulted(vm))                                           \
+            return;                                                   \
+        set_dest(vm, insn, value);                                    \
+        mmu_store(vm, addr, RV_MEM_SW, (STORED_EXPR), false);         \
     } while (0)
 
 static void op_amo(vm_t *vm, uint32_t insn)
@@ -726,7 +1408,7 @@ static void op_amo(vm_t *vm, uint32_t insn)
         if (decode_rs2(insn))
             return vm_set_exception(vm, RV_EXC_ILLEGAL_INSTR, 0);
         mmu_load(vm, addr, RV_MEM_LW, &value, true);
-        if (vm->error)
+        if (vm_faulted(vm))
             return;
         set_dest(vm, insn, value);
         break;
@@ -734,7 +1416,7 @@ static void op_amo(vm_t *vm, uint32_t insn)
         if (addr & 0b11)
             return vm_set_exception(vm, RV_EXC_STORE_MISALIGN, addr);
         bool ok = mmu_store(vm, addr, RV_MEM_SW, read_rs2(vm, insn), true);
-        if (vm->error)
+        if (vm_faulted(vm))
             return;
         set_dest(vm, insn, ok ? 0 : 1);
         break;
@@ -772,91 +1454,508 @@ static void op_amo(vm_t *vm, uint32_t insn)
     }
 }
 
-void vm_step(vm_t *vm)
-{
-    if (unlikely(vm->error))
-        return;
+#if SEMU_HAS(INSN_STATS)
+uint32_t vm_insn_hits[VM_INSN_FORMS];
+_Static_assert(OP_SLLI_SRLI - OP_MV + 1 == VM_INSN_FORMS, "fast path count");
+#endif
 
+/* The first half of a fused pair is done, the second one begins */
+static inline void fused_next(vm_t *vm)
+{
     vm->current_pc = vm->pc;
+    vm->pc += 4;
+}
 
-    if ((vm->sstatus_sie || !vm->s_mode) && (vm->sip & vm->sie)) {
-        uint32_t applicable = (vm->sip & vm->sie);
-        uint8_t idx = ilog2(applicable);
-        vm->exc_cause = (1UL << 31) | idx;
-        vm->stval = 0;
-        vm_trap(vm);
-    }
+#define RS1 vm_get_reg(vm, d->rs1)
+#define RS2 vm_get_reg(vm, d->rs2)
 
-    uint32_t insn;
-    mmu_fetch(vm, vm->pc, &insn);
-    if (unlikely(vm->error))
+/* Execute a predecoded instruction. vm->pc has already been advanced. */
+static inline void vm_exec(vm_t *vm, const decoded_insn_t *d)
+{
+    uint32_t value;
+
+#if SEMU_HAS(INSN_STATS)
+    if (d->op >= OP_MV)
+        vm_insn_hits[d->op - OP_MV]++;
+#endif
+#if SEMU_HAS(ASM_CORE)
+    switch (d->op) {
+    case OP_LUI_ADDI:
+        fused_next(vm);
+        /* fall through */
+    case OP_LUI:
+    case OP_LI:
+        asm_op_li(d);
+        return;
+    case OP_MV:
+        asm_op_mv(d);
+        return;
+    case OP_ADDI:
+        asm_op_addi(d);
         return;
+    case OP_SLLI_SRLI:
+        fused_next(vm);
+        /* fall through */
+    case OP_ANDI:
+        asm_op_andi(d);
+        return;
+    case OP_ADD:
+        asm_op_add(d);
+        return;
+    case OP_SLLI:
+        asm_op_slli(d);
+        return;
+    case OP_SRLI:
+        asm_op_srli(d);
+        return;
+    case OP_NOP:
+        return;
+    case OP_BEQ:
+        value = asm_op_beq(d);
+        break;
+    case OP_BNE:
+        value = asm_op_bne(d);
+        break;
+    case OP_BEQZ:
+        value = asm_op_beqz(d);
+        break;
+    case OP_BNEZ:
+        value = asm_op_bnez(d);
+        break;
+    case OP_JAL:
+    case OP_J:
+        value = asm_op_jal(d);
+        break;
+    case OP_JALR:
+    case OP_JR:
+        value = asm_op_jalr(d);
+        break;
+#if SEMU_HAS(STATIC_BUS)
+    case OP_LOAD:
+        value = decode_func3(d->insn) == RV_MEM_LW ? asm_op_lw(d) : ASM_SLOW;
+        break;
+    case OP_STORE:
+        value = decode_func3(d->insn) == RV_MEM_SW ? asm_op_sw(d) : ASM_SLOW;
+        break;
+#endif
+    default:
+        value = ASM_SLOW;
+        break;
+    }
+    /* the C cases below raise the exception of a misaligned target and do
+     * the loads and stores the handlers leave to them
+     */
+    if (value == ASM_TAKEN)
+        run_reason = VM_RUN_BRANCH;
+    if (value != ASM_SLOW)
+        return;
+#endif
+    switch (d->op) {
+    /* RV32_OP_IMM */
+    case OP_ADDI:
+        set_rd(vm, d->rd, RS1 + d->imm);
+        break;
+    case OP_SLTI:
+        set_rd(vm, d->rd, ((int32_t) RS1) < ((int32_t) d->imm));
+        break;
+    case OP_SLTIU:
+        set_rd(vm, d->rd, RS1 < d->imm);
+        break;
+    case OP_XORI:
+        set_rd(vm, d->rd, RS1 ^ d->imm);
+        break;
+    case OP_ORI:
+        set_rd(vm, d->rd, RS1 | d->imm);
+        break;
+    case OP_ANDI:
+        set_rd(vm, d->rd, RS1 & d->imm);
+        break;
+    case OP_SLLI:
+        set_rd(vm, d->rd, RS1 << d->imm);
+        break;
+    case OP_SRLI:
+        set_rd(vm, d->rd, RS1 >> d->imm);
+        break;
+    case OP_SRAI:
+        set_rd(vm, d->rd, (uint32_t) (((int32_t) RS1) >> d->imm));
+        break;
 
-    vm->pc += 4;
-    vm->insn_count++;
-    uint32_t insn_opcode = insn & MASK(7), value;
-    switch (insn_opcode) {
-    case RV32_OP_IMM:
-        set_dest(vm, insn,
-                 op_rv32i(insn, false, read_rs1(vm, insn), decode_i(insn)));
-        break;
-    case RV32_OP:
-        if (!(insn & (1UL << 25)))
-            set_dest(
-                vm, insn,
-                op_rv32i(insn, true, read_rs1(vm, insn), read_rs2(vm, insn)));
-        else
-            set_dest(vm, insn,
-                     op_mul(insn, read_rs1(vm, insn), read_rs2(vm, insn)));
+    /* RV32_OP */
+    case OP_ADD:
+        set_rd(vm, d->rd, RS1 + RS2);
         break;
-    case RV32_LUI:
-        set_dest(vm, insn, decode_u(insn));
+    case OP_SUB:
+        set_rd(vm, d->rd, RS1 - RS2);
         break;
-    case RV32_AUIPC:
-        set_dest(vm, insn, decode_u(insn) + vm->current_pc);
+    case OP_SLL:
+        set_rd(vm, d->rd, RS1 << (RS2 & MASK(5)));
         break;
-    case RV32_JAL:
-        op_jump_link(vm, insn, decode_j(insn) + vm->current_pc);
+    case OP_SLT:
+        set_rd(vm, d->rd, ((int32_t) RS1) < ((int32_t) RS2));
         break;
-    case RV32_JALR:
-        op_jump_link(vm, insn, (decode_i(insn) + read_rs1(vm, insn)) & ~1);
+    case OP_SLTU:
+        set_rd(vm, d->rd, RS1 < RS2);
         break;
-    case RV32_BRANCH:
-        if (op_jmp(vm, insn, read_rs1(vm, insn), read_rs2(vm, insn)))
-            do_jump(vm, decode_b(insn) + vm->current_pc);
+    case OP_XOR:
+        set_rd(vm, d->rd, RS1 ^ RS2);
         break;
-    case RV32_LOAD:
-        mmu_load(vm, read_rs1(vm, insn) + decode_i(insn), decode_func3(insn),
-                 &value, false);
-        if (unlikely(vm->error))
-            return;
-        set_dest(vm, insn, value);
+    case OP_SRL:
+        set_rd(vm, d->rd, RS1 >> (RS2 & MASK(5)));
+        break;
+    case OP_SRA:
+        set_rd(vm, d->rd, (uint32_t) (((int32_t) RS1) >> (RS2 & MASK(5))));
         break;
-    case RV32_STORE:
-        mmu_store(vm, read_rs1(vm, insn) + decode_s(insn), decode_func3(insn),
-                  read_rs2(vm, insn), false);
-        if (unlikely(vm->error))
+    case OP_OR:
+        set_rd(vm, d->rd, RS1 | RS2);
+        break;
+    case OP_AND:
+        set_rd(vm, d->rd, RS1 & RS2);
+        break;
+    case OP_MULDIV:
+        set_rd(vm, d->rd, op_mul(d->insn, RS1, RS2));
+        break;
+
+#if SEMU_HAS(BITMANIP)
+    /* Zba and Zbb */
+    case OP_SH1ADD:
+        set_rd(vm, d->rd, (RS1 << 1) + RS2);
+        break;
+    case OP_SH2ADD:
+        set_rd(vm, d->rd, (RS1 << 2) + RS2);
+        break;
+    case OP_SH3ADD:
+        set_rd(vm, d->rd, (RS1 << 3) + RS2);
+        break;
+    case OP_ANDN:
+        set_rd(vm, d->rd, RS1 & ~RS2);
+        break;
+    case OP_ORN:
+        set_rd(vm, d->rd, RS1 | ~RS2);
+        break;
+    case OP_XNOR:
+        set_rd(vm, d->rd, ~(RS1 ^ RS2));
+        break;
+    case OP_MIN:
+        value = RS2;
+        set_rd(vm, d->rd, (int32_t) RS1 < (int32_t) value ? RS1 : value);
+        break;
+    case OP_MINU:
+        value = RS2;
+        set_rd(vm, d->rd, RS1 < value ? RS1 : value);
+        break;
+    case OP_MAX:
+        value = RS2;
+        set_rd(vm, d->rd, (int32_t) RS1 > (int32_t) value ? RS1 : value);
+        break;
+    case OP_MAXU:
+        value = RS2;
+        set_rd(vm, d->rd, RS1 > value ? RS1 : value);
+        break;
+    case OP_ROL:
+        set_rd(vm, d->rd, ror32(RS1, -RS2));
+        break;
+    case OP_ROR:
+        set_rd(vm, d->rd, ror32(RS1, RS2));
+        break;
+    case OP_RORI:
+        set_rd(vm, d->rd, ror32(RS1, d->imm));
+        break;
+    case OP_CLZ:
+        set_rd(vm, d->rd, clz32(RS1));
+        break;
+    case OP_CTZ:
+        set_rd(vm, d->rd, ctz32(RS1));
+        break;
+    case OP_CPOP:
+        set_rd(vm, d->rd, cpop32(RS1));
+        break;
+    case OP_SEXT_B:
+        set_rd(vm, d->rd, (int8_t) RS1);
+        break;
+    case OP_SEXT_H:
+        set_rd(vm, d->rd, (int16_t) RS1);
+        break;
+    case OP_ZEXT_H:
+        set_rd(vm, d->rd, (uint16_t) RS1);
+        break;
+    case OP_ORC_B:
+        set_rd(vm, d->rd, orcb32(RS1));
+        break;
+    case OP_REV8:
+        set_rd(vm, d->rd, rev8_32(RS1));
+        break;
+#endif
+
+    /* jumps and branches */
+    case OP_LUI:
+        set_rd(vm, d->rd, d->imm);
+        break;
+    case OP_AUIPC:
+        set_rd(vm, d->rd, d->imm + vm->current_pc);
+        break;
+    case OP_JAL:
+        op_jump_link(vm, d->rd, d->imm + vm->current_pc);
+        break;
+    case OP_JALR:
+        op_jump_link(vm, d->rd, (d->imm + RS1) & ~1);
+        break;
+    case OP_BEQ:
+        if (RS1 == RS2)
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+    case OP_BNE:
+        if (RS1 != RS2)
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+    case OP_BLT:
+        if (((int32_t) RS1) < ((int32_t) RS2))
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+    case OP_BGE:
+        if (((int32_t) RS1) >= ((int32_t) RS2))
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+    case OP_BLTU:
+        if (RS1 < RS2)
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+    case OP_BGEU:
+        if (RS1 >= RS2)
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+
+    /* memory */
+    case OP_LOAD:
+        value = RS1 + d->imm;
+        if (mmu_straddles(value, decode_func3(d->insn)))
+            mmu_load_split(vm, value, decode_func3(d->insn), &value);
+        else
+            mmu_load(vm, value, decode_func3(d->insn), &value, false);
+        if (vm_faulted(vm))
             return;
+        set_rd(vm, d->rd, value);
         break;
-    case RV32_MISC_MEM:
-        switch (decode_func3(insn)) {
-        case 0b000: /* MM_FENCE */
-        case 0b001: /* MM_FENCE_I */
-                    /* TODO: implement for multi-threading */
-            break;
-        default:
+    case OP_STORE:
+        value = RS1 + d->imm;
+        if (mmu_straddles(value, decode_func3(d->insn)))
+            mmu_store_split(vm, value, decode_func3(d->insn), RS2);
+        else
+            mmu_store(vm, value, decode_func3(d->insn), RS2, false);
+        break;
+    case OP_FENCE:
+        /* TODO: implement for multi-threading */
+        break;
+    case OP_FENCE_I:
+        decode_cache_flush();
+        jit_flush();
+        break;
+    case OP_CBO_ZERO:
+        if (!vm->s_mode && !(vm->senvcfg & RV_SENVCFG_CBZE)) {
             vm_set_exception(vm, RV_EXC_ILLEGAL_INSTR, 0);
-            break;
+            return;
         }
+        mmu_zero(vm, RS1 & ~(RV_CBOZ_BLOCK_SIZE - 1));
+        break;
+    case OP_AMO:
+        op_amo(vm, d->insn);
+        break;
+    case OP_SYSTEM:
+        op_system(vm, d->insn);
+        break;
+
+    /* pseudo-instruction forms, see decode_pseudo() */
+    case OP_MV:
+        set_rd(vm, d->rd, RS1);
+        break;
+    case OP_LI:
+        set_rd(vm, d->rd, d->imm);
+        break;
+    case OP_NOP:
         break;
-    case RV32_AMO:
-        op_amo(vm, insn);
+    case OP_J:
+        do_jump(vm, d->imm + vm->current_pc);
         break;
-    case RV32_SYSTEM:
-        op_system(vm, insn);
+    case OP_JR:
+        do_jump(vm, RS1 & ~1);
+        break;
+    case OP_BEQZ:
+        if (!RS1)
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+    case OP_BNEZ:
+        if (RS1)
+            do_jump(vm, d->imm + vm->current_pc);
+        break;
+
+    /* fused pairs, see decode_fuse() */
+    case OP_LUI_ADDI:
+        fused_next(vm);
+        set_rd(vm, d->rd, d->imm);
+        break;
+    case OP_AUIPC_JALR:
+        set_rd(vm, d->rd, decode_u(d->insn) + vm->current_pc);
+        value = d->imm + vm->current_pc;
+        fused_next(vm);
+        op_jump_link(vm, d->rs2, value & ~1);
+        break;
+    case OP_AUIPC_LW:
+        set_rd(vm, d->rd, decode_u(d->insn) + vm->current_pc);
+        value = d->imm + vm->current_pc;
+        fused_next(vm);
+        if (mmu_straddles(value, RV_MEM_LW))
+            mmu_load_split(vm, value, RV_MEM_LW, &value);
+        else
+            mmu_load(vm, value, RV_MEM_LW, &value, false);
+        if (vm_faulted(vm))
+            return;
+        set_rd(vm, d->rs2, value);
+        break;
+    case OP_SLLI_SRLI:
+        fused_next(vm);
+        set_rd(vm, d->rd, RS1 & d->imm);
         break;
     default:
         vm_set_exception(vm, RV_EXC_ILLEGAL_INSTR, 0);
         break;
     }
 }
+
+#undef RS1
+#undef RS2
+
+/* One step of vm_step()/vm_run(), assumes vm->error is clear. If budget is
+ * not NULL, a fused pair or, at a branch target, translated code may run
+ * ahead from the current pc, taking the instructions beyond the first one
+ * from *budget.
+ */
+static inline void vm_step_insn(vm_t *vm,
+                                uint16_t *budget,
+                                bool branch_target UNUSED)
+{
+    vm->current_pc = vm->pc;
+
+    if (unlikely(vm->irq)) {
+        vm->exc_cause = (1UL << 31) | (vm->irq - 1);
+        vm->exc_val = 0;
+        vm_trap(vm);
+        run_reason = VM_RUN_TRAP;
+    }
+
+    uint32_t addr = vm->pc;
+    if (unlikely(!mmu_fetch_translate(vm, &addr))) {
+        slice_budget--;
+        return;
+    }
+#if SEMU_HAS(AOT) || SEMU_HAS(JIT)
+    /* Right after an interrupt is taken, the first handler instruction still
+     * sees the interrupted pc as current_pc, which translated code does not
+     * reproduce.
+     */
+    if (branch_target && run_reason != VM_RUN_TRAP) {
+        uint16_t steps = aot_run(vm, addr, *budget + 1);
+        if (!steps)
+            steps = jit_run(vm, addr, *budget + 1);
+        if (steps) {
+            *budget -= steps - 1;
+            run_reason = VM_RUN_BRANCH;
+            return;
+        }
+    }
+#endif
+    const decoded_insn_t *d = mmu_fetch(vm, addr);
+    if (unlikely(!d)) {
+        slice_budget--;
+        return;
+    }
+    if (unlikely(d->op >= OP_LUI_ADDI)) {
+        if (budget && *budget)
+            (*budget)--;
+        else
+            d = decode_unfuse(d);
+    }
+
+    vm->pc += decode_len(d);
+    vm_exec(vm, d);
+}
+
+#if SEMU_HAS(UNWIND)
+/* Back from a step that raised an exception. A fetch fault retires nothing,
+ * as in vm_step_insn(), and only fetching raises one of those.
+ */
+static void vm_unwound(vm_t *vm)
+{
+    unwind_armed = false;
+    if (vm->exc_cause == RV_EXC_FETCH_FAULT ||
+        vm->exc_cause == RV_EXC_FETCH_PFAULT)
+        slice_budget--;
+}
+#endif
+
+void vm_step(vm_t *vm)
+{
+    if (unlikely(vm->error))
+        return;
+
+#if SEMU_HAS(ASM_CORE)
+    asm_core_bind(vm);
+#endif
+    slice_budget = 1;
+    slice_left = 0;
+#if SEMU_HAS(UNWIND)
+    if (setjmp(unwind_point)) {
+        vm_unwound(vm);
+        vm_retire(vm);
+        return;
+    }
+    unwind_armed = true;
+#endif
+    vm_step_insn(vm, NULL, false);
+#if SEMU_HAS(UNWIND)
+    unwind_armed = false;
+#endif
+    vm_retire(vm);
+}
+
+vm_run_t vm_run(vm_t *vm, uint16_t budget)
+{
+    vm->budget = budget;
+    if (unlikely(vm->error))
+        return VM_RUN_ERROR;
+#if SEMU_HAS(ASM_CORE)
+    asm_core_bind(vm);
+#endif
+
+    /* a run starts at a branch target, where translated blocks begin */
+    bool branch_target = true;
+    run_reason = VM_RUN_BUDGET;
+    slice_budget = slice_left = budget;
+#if SEMU_HAS(UNWIND)
+    /* set once per run, the steps only poll for errors set other than by
+     * vm_set_exception(), such as ERR_USER
+     */
+    if (setjmp(unwind_point)) {
+        vm_unwound(vm);
+        vm->budget = slice_left;
+        vm_retire(vm);
+        return VM_RUN_ERROR;
+    }
+    unwind_armed = true;
+#endif
+    while (slice_left) {
+        slice_left--;
+        vm_step_insn(vm, &slice_left, branch_target);
+        branch_target = false;
+        if (unlikely(vm->error)) {
+            run_reason = VM_RUN_ERROR;
+            break;
+        }
+        if (run_reason != VM_RUN_BUDGET)
+            break;
+    }
+#if SEMU_HAS(UNWIND)
+    unwind_armed = false;
+#endif
+    vm->budget = slice_left;
+    vm_retire(vm);
+    return run_reason;
+}
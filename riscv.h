@@ -29,6 +29,16 @@ typedef enum {
     ERR_USER,      /**< user-specific error */
 } vm_error_t;
 
+/* Reasons for "vm_run()" to hand control back to the environment */
+typedef enum {
+    VM_RUN_BUDGET, /**< the budget is used up */
+    VM_RUN_BRANCH, /**< a branch or jump was taken */
+    VM_RUN_TRAP,   /**< an interrupt was taken */
+    VM_RUN_MMIO,   /**< a load or store went outside of RAM */
+    VM_RUN_WFI,    /**< WFI with no enabled interrupt pending */
+    VM_RUN_ERROR,  /**< vm->error is set, see above */
+} vm_run_t;
+
 /* To use the emulator, start by initializing a "vm_t" struct with zero values
  * and set the required environment-supplied callbacks. You may also set other
  * necessary fields such as argument registers and s_mode, ensuring that all
@@ -36,6 +46,8 @@ typedef enum {
  *
  * Once the emulator is set up, execute the emulation loop by calling
  * "vm_step()" repeatedly. Each call attempts to execute a single instruction.
+ * Alternatively, "vm_run()" executes a whole run of straight-line code per
+ * call, which saves the per-instruction call overhead.
  *
  * If the execution completes successfully, the "vm->error" field will be set
  * to ERR_NONE. However, if an error occurs during execution, the emulator will
@@ -46,8 +58,39 @@ typedef enum {
  */
 typedef struct __vm_internal vm_t;
 
+/* Bits of vm->sstatus, which holds the writable ones of the sstatus CSR in
+ * their place there.
+ */
+enum {
+    VM_SSTATUS_SIE = 1,
+    VM_SSTATUS_SPIE = 5,
+    VM_SSTATUS_SPP = 8,
+    VM_SSTATUS_SUM = 18,
+    VM_SSTATUS_MXR = 19,
+};
+
+/* Test, set and clear bit VM_SSTATUS_x of vm->sstatus. Each of them works on
+ * the one byte the bit is in rather than on the whole word.
+ */
+#define vm_sstatus_byte(vm, x) \
+    (((uint8_t *) &(vm)->sstatus)[VM_SSTATUS_##x / 8])
+#define vm_sstatus(vm, x) \
+    ((vm_sstatus_byte(vm, x) >> (VM_SSTATUS_##x % 8)) & 1)
+#define vm_sstatus_set(vm, x) \
+    (vm_sstatus_byte(vm, x) |= 1 << (VM_SSTATUS_##x % 8))
+#define vm_sstatus_clear(vm, x) \
+    (vm_sstatus_byte(vm, x) &= ~(1 << (VM_SSTATUS_##x % 8)))
+
 struct __vm_internal {
+    /* General purpose registers, use vm_get_reg() and vm_set_reg() to access
+     * them. With REG_PLANES, byte k of register r is x_regs[k][r], so the
+     * register number indexes all four bytes. The planes never cross a page.
+     */
+#if SEMU_HAS(REG_PLANES)
+    uint8_t x_regs[4][32] __attribute__((aligned(128)));
+#else
     uint32_t x_regs[32];
+#endif
 
     /* LR reservation virtual address. last bit is 1 if valid */
     uint32_t lr_reservation;
@@ -61,7 +104,7 @@ struct __vm_internal {
     /* 'instructions executed' 64-bit counter serves as a real-time clock,
      * instruction-retired counter, and cycle counter. It is currently
      * utilized in these capacities and should not be modified between logical
-     * resets.
+     * resets. It is brought up to date when vm_step() or vm_run() returns.
      */
     uint32_t insn_count, insn_count_hi;
 
@@ -71,6 +114,12 @@ struct __vm_internal {
      */
     vm_error_t error;
 
+    /* Steps left over from the budget of the last vm_run() call */
+    uint16_t budget;
+
+    uint8_t irq; /**< interrupt to take plus one, 0 if none, vm_update_irq() */
+    bool s_mode;
+
     /* If the error value is ERR_EXCEPTION, the specified values will be used
      * for the scause and stval registers if they are turned into a trap.
      * Refer to the RISC-V specification for the meaning of these values.
@@ -78,41 +127,100 @@ struct __vm_internal {
     uint32_t exc_cause, exc_val;
 
     /* Supervisor state */
-    bool s_mode;
-    bool sstatus_spp; /**< state saved at trap */
-    bool sstatus_spie;
+    uint32_t sstatus; /**< SIE, SPIE, SPP, SUM and MXR, see vm_sstatus() */
     uint32_t sepc;
     uint32_t scause;
     uint32_t stval;
-    bool sstatus_mxr; /**< alter MMU access rules */
-    bool sstatus_sum;
-    bool sstatus_sie; /**< interrupt state */
     uint32_t sie;
     uint32_t sip;
     uint32_t stvec_addr; /**< trap config */
     bool stvec_vectored;
     uint32_t sscratch; /**< misc */
     uint32_t scounteren;
+    uint32_t senvcfg; /**< only CBZE is writable */
     uint32_t satp; /**< MMU */
-    int32_t page_table_addr;
+    int32_t page_table_addr; /**< 0 with the MMU off, set by satp writes */
 
     void *priv; /**< environment supplied */
 
     /* Memory access sets the vm->error to indicate failure. On successful
-     * access, it reads or writes the specified "value".
+     * access, it reads or writes the specified "value". With STATIC_BUS,
+     * riscv.c calls the functions of bus.h instead of these and mem_zero.
      */
     void (*mem_fetch)(vm_t *vm, uint32_t addr, uint32_t *value);
     void (*mem_load)(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value);
     void (*mem_store)(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value);
+
+    /* Zero len bytes at the aligned physical address addr, for cbo.zero. If
+     * it is NULL, they are zeroed a word at a time through mem_store.
+     */
+    void (*mem_zero)(vm_t *vm, uint32_t addr, uint16_t len);
 };
 
+/* Read register r */
+static inline uint32_t vm_get_reg(const vm_t *vm, uint8_t r)
+{
+#if SEMU_HAS(REG_PLANES)
+    return vm->x_regs[0][r] | (uint16_t) vm->x_regs[1][r] << 8 |
+           (uint32_t) vm->x_regs[2][r] << 16 |
+           (uint32_t) vm->x_regs[3][r] << 24;
+#else
+    return vm->x_regs[r];
+#endif
+}
+
+/* Write register r, writes to x0 are ignored */
+static inline void vm_set_reg(vm_t *vm, uint8_t r, uint32_t x)
+{
+    if (!r)
+        return;
+#if SEMU_HAS(REG_PLANES)
+    vm->x_regs[0][r] = x;
+    vm->x_regs[1][r] = x >> 8;
+    vm->x_regs[2][r] = x >> 16;
+    vm->x_regs[3][r] = x >> 24;
+#else
+    vm->x_regs[r] = x;
+#endif
+}
+
+#if SEMU_HAS(INSN_STATS)
+/* Instructions run through the fast paths for the common pseudo-instruction
+ * forms mv, li, nop, j, jr (ret), beqz and bnez, followed by the fused pairs
+ * lui+addi, auipc+jalr, auipc+lw and slli+srli, in that order. A fused pair
+ * counts once.
+ */
+#define VM_INSN_FORMS 11
+extern uint32_t vm_insn_hits[VM_INSN_FORMS];
+#endif
+
+/* Recompute vm->irq, which vm_step() and vm_run() check instead of the
+ * fields it depends on. It has to be called after changing vm->sip from
+ * outside, the emulated instructions and vm_trap() take care of the rest.
+ */
+void vm_update_irq(vm_t *vm);
+
 /* Emulate the next instruction. This is a no-op if the error is already set. */
 void vm_step(vm_t *vm);
 
+/* Emulate up to "budget" steps, each one equivalent to a "vm_step()" call,
+ * and stop early when straight-line execution ends: after a taken branch or
+ * jump, a taken interrupt, an access outside of RAM or an error. Returns the
+ * reason and leaves the unused part of the budget in vm->budget. As with
+ * "vm_step()", an error must be handled before running again.
+ */
+vm_run_t vm_run(vm_t *vm, uint16_t budget);
+
 /* Raise a RISC-V exception. This is equivalent to setting vm->error to
  * ERR_EXCEPTION and setting the accompanying fields. It is provided as
  * a function for convenience and to prevent mistakes such as forgetting to
  * set a field.
+ *
+ * With UNWIND, it does not return when called from within "vm_step()" or
+ * "vm_run()", e.g. by a memory callback, but ends the step right away with
+ * a longjmp() back into them, which then return as described above. An error
+ * set directly in vm->error, such as ERR_USER, still lets the rest of the
+ * instruction run before they return.
  */
 void vm_set_exception(vm_t *vm, uint32_t cause, uint32_t val);
 
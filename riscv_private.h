@@ -80,6 +80,11 @@ enum {
 /* privileged ISA: other */
 enum { RV_PAGE_SHIFT = 12, RV_PAGE_SIZE = 1 << RV_PAGE_SHIFT };
 
+/* cbo.zero clears aligned blocks of this size, riscv,cboz-block-size in
+ * minimal.dts has to match. senvcfg.CBZE allows it in U-mode.
+ */
+enum { RV_CBOZ_BLOCK_SIZE = 1024, RV_SENVCFG_CBZE = 1 << 7 };
+
 enum {
     RV_INT_SSI = 1,
     RV_INT_SSI_BIT = (1 << RV_INT_SSI),
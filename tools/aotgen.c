@@ -0,0 +1,265 @@
+/* aotgen: translate a kernel text in an REU image into 6502 overlays
+ *
+ * usage: aotgen -r REGS [-p] [-v VDELTA] [-b BASE] [-f] REUFILE START END
+ *
+ * START and END are the physical addresses of the kernel text (_stext and
+ * _etext minus the virtual offset VDELTA, 0xC0000000 by default). REGS is
+ * the address of the register file in the semu build the overlays are for,
+ * printed as "vm state begin" at startup, and -p has to be given if that
+ * build has ENABLE_REG_PLANES=1. The overlays are written into the
+ * image at BASE (AOT_REU_BASE by default), which has to be unused, that is
+ * all zero, unless -f is given. See aot.h for the format.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aot.h"
+#include "decode.h"
+#include "device.h"
+#include "jit_emit.h"
+#include "riscv_private.h"
+
+#define MAX_BLOCKS 255
+
+static uint8_t *image;
+static uint32_t text_start, text_end;
+static uint8_t *entry; /**< one byte per text word, set if a block starts */
+static bool planes;    /**< registers in byte planes */
+
+static uint32_t fetch(uint32_t addr)
+{
+    uint32_t insn;
+    memcpy(&insn, image + addr, sizeof(insn));
+    return insn;
+}
+
+static void mark_entry(uint32_t addr)
+{
+    if (addr >= text_start && addr < text_end && !(addr & 0b11))
+        entry[(addr - text_start) >> 2] = 1;
+}
+
+/* Blocks start at page starts, at targets of direct jumps and branches, and
+ * behind every control transfer, where calls return to and where the
+ * interpreter hands back after a jalr or an untranslated branch.
+ */
+static void find_entries(void)
+{
+    for (uint32_t addr = text_start; addr < text_end; addr += 4) {
+        decoded_insn_t d;
+        decode_insn(&d, fetch(addr));
+        if (!(addr & MASK(RV_PAGE_SHIFT)))
+            mark_entry(addr);
+        switch (d.op) {
+        case OP_JAL:
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGE:
+        case OP_BLTU:
+        case OP_BGEU:
+            mark_entry(addr + d.imm);
+            /* fall through */
+        case OP_JALR:
+        case OP_SYSTEM:
+            mark_entry(addr + 4);
+            break;
+        }
+    }
+}
+
+/* Translate the page at addr into overlay, returns its size and sets
+ * *blocks, zero if nothing could be translated.
+ */
+static uint16_t translate_page(uint8_t *overlay,
+                               uint32_t addr,
+                               uint16_t regs,
+                               uint32_t vdelta,
+                               uint16_t *blocks)
+{
+    static aot_block_t block[MAX_BLOCKS];
+    static uint8_t code[AOT_WINDOW_SIZE];
+    uint32_t end = addr + RV_PAGE_SIZE;
+    uint8_t n = 0;
+    jit_emit_t e = {.pos = code, .regs = regs, .planes = planes};
+
+    if (end > text_end)
+        end = text_end;
+    for (uint32_t pc = addr; pc < end && n < MAX_BLOCKS; pc += 4) {
+        if (!entry[(pc - text_start) >> 2])
+            continue;
+        /* up to the next entry, where another block takes over */
+        uint32_t stop = pc + 4;
+        while (stop < end && !entry[(stop - text_start) >> 2])
+            stop += 4;
+        uint32_t max_len = (stop - pc) >> 2;
+        if (max_len > 255)
+            max_len = 255;
+
+        uint8_t *const start = e.pos;
+        e.end = code + AOT_WINDOW_SIZE - (n + 1) * sizeof(aot_block_t);
+        if (start >= e.end)
+            break;
+        const uint8_t len = jit_emit_block(&e, pc + vdelta, pc, max_len, fetch);
+        if (e.full) {
+            e.pos = start;
+            break;
+        }
+        if (!len)
+            continue;
+        block[n].off = pc & MASK(RV_PAGE_SHIFT);
+        block[n].code = start - code;
+        block[n].len = len;
+        block[n].exit[0] = e.exit_pc[0] - (pc + vdelta);
+        block[n].exit[1] = e.exit_pc[1] - (pc + vdelta);
+        block[n].reserved = 0;
+        n++;
+    }
+    if (!n)
+        return 0;
+
+    /* chain exits into blocks of the same page */
+    const uint32_t page = addr & ~MASK(RV_PAGE_SHIFT);
+    for (uint8_t i = 0; i < n; i++) {
+        for (uint8_t k = 0; k < 2; k++) {
+            const uint32_t next = page + block[i].off + block[i].exit[k];
+            block[i].next[k] = AOT_NONE;
+            if ((next ^ page) & ~MASK(RV_PAGE_SHIFT))
+                continue;
+            for (uint8_t j = 0; j < n; j++)
+                if (block[j].off == (next & MASK(RV_PAGE_SHIFT)))
+                    block[i].next[k] = j;
+        }
+    }
+
+    const uint16_t table = n * sizeof(aot_block_t);
+    for (uint8_t i = 0; i < n; i++)
+        block[i].code += table;
+    memcpy(overlay, block, table);
+    memcpy(overlay + table, code, e.pos - code);
+    *blocks = n;
+    return table + (e.pos - code);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: aotgen -r REGS [-p] [-v VDELTA] [-b BASE] [-f] REUFILE "
+            "START END\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t regs = 0, vdelta = 0xC0000000, base = AOT_REU_BASE;
+    int force = 0, opt;
+
+    while ((opt = getopt(argc, argv, "r:pv:b:f")) != -1) {
+        switch (opt) {
+        case 'r':
+            regs = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            planes = true;
+            break;
+        case 'v':
+            vdelta = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            base = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            force = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - optind != 3 || !regs || regs > 0xFFFF)
+        usage();
+    text_start = strtoul(argv[optind + 1], NULL, 0) & ~MASK(2);
+    text_end = strtoul(argv[optind + 2], NULL, 0);
+    if (text_start >= text_end || text_end > base || base >= RAM_SIZE) {
+        fprintf(stderr, "aotgen: text must be below BASE, BASE in the REU\n");
+        return 1;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+    image = calloc(RAM_SIZE, 1);
+    size_t size = fread(image, 1, RAM_SIZE, f);
+    fclose(f);
+
+    entry = calloc((text_end - text_start) / 4 + 1, 1);
+    find_entries();
+
+    /* header and directory first, the overlays follow */
+    const uint32_t first_page = text_start >> RV_PAGE_SHIFT;
+    const uint32_t pages =
+        ((text_end + RV_PAGE_SIZE - 1) >> RV_PAGE_SHIFT) - first_page;
+    aot_header_t hdr = {
+        .magic = planes ? AOT_MAGIC_PLANES : AOT_MAGIC,
+        .regs = regs,
+        .vdelta = vdelta,
+        .first_page = first_page,
+        .pages = pages,
+    };
+    aot_page_t *dir = calloc(pages, sizeof(*dir));
+    static uint8_t out[RAM_SIZE + AOT_WINDOW_SIZE];
+    uint32_t used = sizeof(hdr) + pages * sizeof(*dir);
+    uint32_t translated = 0;
+
+    for (uint32_t i = 0; i < pages; i++) {
+        uint32_t addr = (first_page + i) << RV_PAGE_SHIFT;
+        if (addr < text_start)
+            addr = text_start;
+        uint16_t blocks;
+        const uint16_t len =
+            translate_page(out + used, addr, regs, vdelta, &blocks);
+        if (!len)
+            continue;
+        if (base + used + len > RAM_SIZE) {
+            fprintf(stderr, "aotgen: overlays do not fit below 0x%x\n",
+                    (unsigned) RAM_SIZE);
+            return 1;
+        }
+        dir[i].offset = used;
+        dir[i].size = len;
+        dir[i].blocks = blocks;
+        if (len > hdr.window)
+            hdr.window = len;
+        used += len;
+        translated++;
+    }
+    memcpy(out, &hdr, sizeof(hdr));
+    memcpy(out + sizeof(hdr), dir, pages * sizeof(*dir));
+
+    if (!force) {
+        for (uint32_t i = 0; i < used; i++) {
+            if (image[base + i]) {
+                fprintf(stderr,
+                        "aotgen: 0x%x is in use, pick another BASE or use -f\n",
+                        (unsigned) (base + i));
+                return 1;
+            }
+        }
+    }
+    memcpy(image + base, out, used);
+    if (size < base + used)
+        size = base + used;
+
+    f = fopen(argv[optind], "wb");
+    if (!f || fwrite(image, 1, size, f) != size) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fclose(f);
+    printf("aotgen: %u of %u pages, %u bytes at 0x%x\n", (unsigned) translated,
+           (unsigned) pages, (unsigned) used, (unsigned) base);
+    return 0;
+}
@@ -0,0 +1,85 @@
+/* asm_cycles: run one guest instruction over and over, for counting cycles
+ *
+ * tools/asm_cycles.sh builds this with mos-sim-clang, with and without
+ * ENABLE_ASM_CORE, and runs it in mos-sim. INSN is the instruction word and
+ * STEPS the number of vm_step() calls; the cycles of two runs with different
+ * STEPS differ by what those extra steps take. Guest RAM is 8KiB here, the
+ * code fills the first 4KiB and x7 points to data behind it. The MMU is off.
+ *
+ * With INSN2 as well, the code is pairs of INSN and INSN2, and each of the
+ * STEPS is a vm_run() of two instructions, which with ENABLE_FUSE runs a
+ * pair that decode_fuse() takes as a single step.
+ */
+#include <string.h>
+
+#include "device.h"
+#include "reu.h"
+#include "riscv.h"
+#include "riscv_private.h"
+
+#define GUEST_RAM 0x2000
+
+static uint32_t ram[GUEST_RAM / 4];
+
+uint32_t loadword_reu(uint32_t addr)
+{
+    return ram[(addr % GUEST_RAM) >> 2];
+}
+
+uint32_t fetchword_reu(uint32_t addr)
+{
+    return loadword_reu(addr);
+}
+
+void saveword_reu(uint32_t addr, uint32_t value)
+{
+    ram[(addr % GUEST_RAM) >> 2] = value;
+}
+
+void reu_read(void *dst, uint32_t addr, uint16_t len)
+{
+    memcpy(dst, (uint8_t *) ram + addr % GUEST_RAM, len);
+}
+
+void reu_fill(uint32_t addr, uint8_t value, uint16_t len)
+{
+    memset((uint8_t *) ram + addr % GUEST_RAM, value, len);
+}
+
+void bus_load_mmio(vm_t *vm, uint32_t addr UNUSED, uint8_t width UNUSED,
+                   uint32_t *value UNUSED)
+{
+    vm_set_exception(vm, RV_EXC_LOAD_FAULT, vm->exc_val);
+}
+
+void bus_store_mmio(vm_t *vm, uint32_t addr UNUSED, uint8_t width UNUSED,
+                    uint32_t value UNUSED)
+{
+    vm_set_exception(vm, RV_EXC_STORE_FAULT, vm->exc_val);
+}
+
+int main(void)
+{
+    static emu_state_t emu;
+    static vm_t vm;
+
+    for (uint16_t i = 0; i < GUEST_RAM / 8; i++)
+#ifdef INSN2
+        ram[i] = i & 1 ? INSN2 : INSN;
+#else
+        ram[i] = INSN;
+#endif
+    vm.priv = &emu;
+    vm.s_mode = true;
+    vm_set_reg(&vm, 5, 1);
+    vm_set_reg(&vm, 6, 2);
+    vm_set_reg(&vm, 7, GUEST_RAM / 2);
+    for (uint16_t n = STEPS; n; n--) {
+#ifdef INSN2
+        vm_run(&vm, 2);
+#else
+        vm_step(&vm);
+#endif
+    }
+    return vm.error;
+}
@@ -0,0 +1,94 @@
+#!/bin/sh
+# Cycles per vm_step() of the instructions asm_core.S handles, with the C
+# cases of vm_exec() (ENABLE_ASM_CORE=0) and with the handlers (=1), both
+# with ENABLE_REG_PLANES=1. Needs mos-sim-clang and mos-sim of llvm-mos on
+# the PATH, run from the top of the tree:
+#
+#   sh tools/asm_cycles.sh
+#
+# A step is the whole of vm_step(), fetch and decode cache lookup included,
+# so the figures are higher than those of the header of asm_core.S; the
+# difference between the two columns is what the handlers save.
+#
+# The second table has the cycles of a vm_run() of the instruction pairs
+# decode_fuse() recognises, built with ENABLE_FUSE=0 and =1, for both the C
+# cases and the handlers; the difference is what running a pair as one step
+# saves.
+
+set -e
+
+CC=${CC:-mos-sim-clang}
+SIM=${SIM:-mos-sim}
+N=256
+OUT=${TMPDIR:-/tmp}/asm_cycles.$$
+trap 'rm -f $OUT.elf' EXIT
+
+# name and instruction word, x5 = 1, x6 = 2 and x7 = data address
+INSNS="
+addi:0x00128293
+add:0x006282b3
+li:0x00500293
+mv:0x00030293
+andi:0x0ff2f293
+slli:0x00129293
+lui:0x123452b7
+beqz:0x00000263
+bne:0x00629263
+j:0x0040006f
+lw:0x0003a283
+sw:0x0053a023
+"
+
+# name and the two instruction words of a fused pair
+PAIRS="
+lui+addi:0x123452b7:0x67828293
+auipc+jalr:0x00000097:0x008080e7
+auipc+lw:0x00000297:0x4002a283
+slli+srli:0x01029293:0x0102d293
+"
+
+# cycles of STEPS steps of the instruction $2 with ENABLE_ASM_CORE=$1, or of
+# STEPS runs of the pair $2 $4 with ENABLE_FUSE=$5
+run() {
+    asm=
+    [ "$1" = 1 ] && asm=asm_core.S
+    pair=
+    [ -n "$4" ] && pair="-D INSN2=$4 -D SEMU_FEATURE_FUSE=$5"
+    $CC -Os -flto -I. -include common.h \
+        -D SEMU_FEATURE_ASM_CORE=$1 -D SEMU_FEATURE_REG_PLANES=1 \
+        -D SEMU_FEATURE_STATIC_BUS=1 -D INSN=$2 -D STEPS=$3 $pair \
+        -o $OUT.elf tools/asm_cycles.c riscv.c decode.c muldiv.c \
+        bitmanip.c ram.c $asm
+    $SIM --cycles $OUT.elf 2>&1 >/dev/null | grep -o '[0-9][0-9]*' | tail -n 1
+}
+
+printf '%-6s %6s %6s\n' insn C asm
+for i in $INSNS; do
+    name=${i%%:*}
+    insn=${i#*:}
+    line=$name
+    for asm in 0 1; do
+        one=$(run $asm $insn 1)
+        many=$(run $asm $insn $((N + 1)))
+        line="$line $(((many - one) / N))"
+    done
+    printf '%-6s %6s %6s\n' $line
+done
+
+echo
+printf '%-10s %6s %6s %6s %6s\n' pair C fused asm fused
+for i in $PAIRS; do
+    name=${i%%:*}
+    insns=${i#*:}
+    first=${insns%%:*}
+    second=${insns#*:}
+    line=$name
+    for asm in 0 1; do
+        for fuse in 0 1; do
+            one=$(run $asm $first 1 $second $fuse)
+            many=$(run $asm $first $((N + 1)) $second $fuse)
+            line="$line $(((many - one) / N))"
+        done
+    done
+    printf '%-10s %6s %6s %6s %6s\n' $line
+done
@@ -0,0 +1,325 @@
+/* gendecode: generate the decoder tables of decode.c from decode.isa
+ *
+ * usage: gendecode ISAFILE > decode_table.h
+ *
+ * Each line of ISAFILE gives the bit pattern of an instruction, its
+ * immediate format, its handler index and optionally the SEMU_HAS() feature
+ * it depends on, see decode.isa. The output has
+ *
+ * - decode_slots[], indexed by opcode[6:2] and funct3. An entry is either
+ *   the handler, or DECODE_SUB and the first of the decode_subs[] patterns
+ *   that tell the instructions sharing the slot apart by their other bits.
+ * - decode_formats[], the immediate format of each handler.
+ * - decode_imm(), which assembles the immediate of a format byte by byte,
+ *   from 8-bit shifts and masks of the instruction bytes.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INSNS 256
+#define MAX_SUBS 127 /* indices below DECODE_SUB */
+
+/* the opcode and funct3 bits, which select the slot */
+#define SLOT_BITS 0x707Fu
+
+typedef struct {
+    char name[16], handler[32], feature[32];
+    uint32_t mask, match;
+    int format;
+    int line;
+} insn_t;
+
+enum { FMT_R, FMT_I, FMT_SH, FMT_S, FMT_B, FMT_U, FMT_J, FMT_COUNT };
+
+static const char *const format_names[FMT_COUNT] = {
+    "R", "I", "SH", "S", "B", "U", "J",
+};
+
+static insn_t insns[MAX_INSNS];
+static int n_insns;
+static const char *isa_file;
+
+static void fail(int line, const char *msg, const char *what)
+{
+    fprintf(stderr, "%s:%d: %s%s%s\n", isa_file, line, msg, what ? ": " : "",
+            what ? what : "");
+    exit(1);
+}
+
+static void parse(FILE *f)
+{
+    char buf[256];
+    int line = 0;
+
+    while (fgets(buf, sizeof(buf), f)) {
+        char pattern[64], format[8];
+        insn_t *in = &insns[n_insns];
+
+        line++;
+        if (buf[0] == '#' || strspn(buf, " \t\r\n") == strlen(buf))
+            continue;
+        if (n_insns == MAX_INSNS)
+            fail(line, "too many instructions", NULL);
+        in->feature[0] = '\0';
+        if (sscanf(buf, "%15s %63s %7s %31s %31s", in->name, pattern, format,
+                   in->handler, in->feature) < 4)
+            fail(line, "expected name, pattern, format and handler", NULL);
+        if (strlen(pattern) != 32)
+            fail(line, "the pattern needs 32 bits", pattern);
+
+        in->mask = in->match = 0;
+        for (int i = 0; i < 32; i++) {
+            const uint32_t bit = 1u << (31 - i);
+            if (pattern[i] == '-')
+                continue;
+            if (pattern[i] != '0' && pattern[i] != '1')
+                fail(line, "bits are 0, 1 or -", pattern);
+            in->mask |= bit;
+            if (pattern[i] == '1')
+                in->match |= bit;
+        }
+        if ((in->mask & 0x7F) != 0x7F || (in->match & 0b11) != 0b11)
+            fail(line, "the opcode has to be given and end in 11", pattern);
+
+        in->format = -1;
+        for (int i = 0; i < FMT_COUNT; i++) {
+            if (!strcmp(format, format_names[i]))
+                in->format = i;
+        }
+        if (in->format < 0)
+            fail(line, "unknown format", format);
+        in->line = line;
+        n_insns++;
+    }
+}
+
+/* the handler of in, which is illegal without its feature */
+static void print_handler(const insn_t *in)
+{
+    if (in->feature[0])
+        printf("SEMU_HAS(%s) ? %s : OP_ILLEGAL", in->feature, in->handler);
+    else
+        printf("%s", in->handler);
+}
+
+static void print_bytes(uint32_t x)
+{
+    printf("{0x%02X, 0x%02X, 0x%02X, 0x%02X}", x & 0xFF, x >> 8 & 0xFF,
+           x >> 16 & 0xFF, x >> 24);
+}
+
+static void gen_slots(void)
+{
+    static insn_t subs[MAX_SUBS];
+    static uint32_t sub_mask[MAX_SUBS];
+    int n_subs = 0;
+
+    printf("/* by opcode[6:2] << 3 | funct3, the rest is OP_ILLEGAL */\n");
+    printf("static const uint8_t decode_slots[256] = {\n");
+    for (int slot = 0; slot < 256; slot++) {
+        const uint32_t word = (uint32_t) (slot >> 3) << 2 | 0b11 |
+                              (uint32_t) (slot & 7) << 12;
+        const insn_t *fit[MAX_INSNS];
+        int n_fit = 0;
+
+        for (int i = 0; i < n_insns; i++) {
+            const uint32_t m = insns[i].mask & SLOT_BITS;
+            if ((word & m) == (insns[i].match & m))
+                fit[n_fit++] = &insns[i];
+        }
+        if (!n_fit)
+            continue;
+
+        printf("    [0x%02X] = ", slot);
+        if (!(fit[0]->mask & ~SLOT_BITS)) {
+            if (n_fit > 1)
+                fail(fit[1]->line, "never decoded, shadowed by", fit[0]->name);
+            print_handler(fit[0]);
+            printf(", /* %s */\n", fit[0]->name);
+            continue;
+        }
+
+        /* the first pattern to fit wins, OP_ILLEGAL if none does */
+        printf("DECODE_SUB | %d, /*", n_subs);
+        bool last = false;
+        for (int i = 0; i < n_fit && !last; i++) {
+            if (n_subs == MAX_SUBS)
+                fail(fit[i]->line, "too many patterns in shared slots", NULL);
+            printf(" %s", fit[i]->name);
+            last = !(fit[i]->mask & ~SLOT_BITS);
+            subs[n_subs] = *fit[i];
+            sub_mask[n_subs++] = fit[i]->mask & ~SLOT_BITS;
+        }
+        if (!last) {
+            if (n_subs == MAX_SUBS)
+                fail(fit[0]->line, "too many patterns in shared slots", NULL);
+            strcpy(subs[n_subs].handler, "OP_ILLEGAL");
+            subs[n_subs].feature[0] = '\0';
+            subs[n_subs].match = 0;
+            sub_mask[n_subs++] = 0;
+        }
+        printf(" */\n");
+    }
+    printf("};\n\n");
+
+    printf("static const decode_pattern_t decode_subs[%d] = {\n", n_subs);
+    for (int i = 0; i < n_subs; i++) {
+        printf("    {");
+        print_bytes(sub_mask[i]);
+        printf(", ");
+        print_bytes(subs[i].match & sub_mask[i]);
+        printf(", ");
+        print_handler(&subs[i]);
+        printf("},\n");
+    }
+    printf("};\n\n");
+}
+
+/* every handler is listed, so that the array covers all of them */
+static void gen_formats(void)
+{
+    printf("static const uint8_t decode_formats[] = {\n");
+    for (int i = 0; i < n_insns; i++) {
+        bool seen = false;
+        for (int j = 0; j < i; j++) {
+            if (strcmp(insns[j].handler, insns[i].handler))
+                continue;
+            if (insns[j].format != insns[i].format)
+                fail(insns[i].line, "another format for", insns[i].handler);
+            seen = true;
+        }
+        if (!seen)
+            printf("    [%s] = DECODE_%s,\n", insns[i].handler,
+                   format_names[insns[i].format]);
+    }
+    printf("};\n\n");
+}
+
+/* The instruction bit that bit i of an immediate of format comes from, -1
+ * if it is zero. Bit 31 is the sign of all but the shift amount.
+ */
+static int imm_source(int format, int i)
+{
+    switch (format) {
+    case FMT_I:
+        return i < 11 ? 20 + i : 31;
+    case FMT_SH:
+        return i < 5 ? 20 + i : -1;
+    case FMT_S:
+        return i < 5 ? 7 + i : i < 11 ? 20 + i : 31;
+    case FMT_B:
+        if (!i)
+            return -1;
+        return i < 5 ? 7 + i : i < 11 ? 20 + i : i == 11 ? 7 : 31;
+    case FMT_U:
+        return i < 12 ? -1 : i;
+    case FMT_J:
+        if (!i)
+            return -1;
+        return i < 11 ? 20 + i : i == 11 ? 20 : i < 20 ? i : 31;
+    default:
+        return -1;
+    }
+}
+
+/* imm[byte] of format as an expression of the instruction bytes b[] */
+static void gen_imm_byte(int format, int byte)
+{
+    uint8_t srcmask[4][15] = {{0}}; /* by source byte and shift + 7 */
+    uint8_t sign = 0;
+    int terms = 0;
+
+    for (int i = 0; i < 8; i++) {
+        const int src = imm_source(format, byte * 8 + i);
+        if (src == 31 && !(format == FMT_U && byte == 3))
+            sign |= 1 << i;
+        else if (src >= 0)
+            srcmask[src / 8][i - src % 8 + 7] |= 1 << (src % 8);
+    }
+
+    printf("        imm[%d] = ", byte);
+    for (int k = 0; k < 4; k++) {
+        for (int s = 0; s < 15; s++) {
+            const uint8_t m = srcmask[k][s];
+            const int shift = s - 7;
+            if (!m)
+                continue;
+            printf("%s", terms++ ? " | " : "");
+            if (!shift && m == 0xFF)
+                printf("b[%d]", k);
+            else if (!shift)
+                printf("(b[%d] & 0x%02X)", k, m);
+            else if (shift < 0 && m == (uint8_t) (0xFF << -shift))
+                printf("(b[%d] >> %d)", k, -shift);
+            else if (shift < 0)
+                printf("(b[%d] >> %d & 0x%02X)", k, -shift, m >> -shift);
+            else if (m == 0xFF >> shift)
+                printf("(uint8_t) (b[%d] << %d)", k, shift);
+            else
+                printf("(uint8_t) ((b[%d] & 0x%02X) << %d)", k, m, shift);
+        }
+    }
+    if (sign == 0xFF)
+        printf("%ssign", terms++ ? " | " : "");
+    else if (sign)
+        printf("%s(sign & 0x%02X)", terms++ ? " | " : "", sign);
+    printf("%s;\n", terms ? "" : "0");
+}
+
+static void gen_imm(void)
+{
+    printf("/* The immediate of format from the instruction bytes b[] */\n");
+    printf("static inline uint32_t decode_imm(uint8_t format, "
+           "const uint8_t *b)\n{\n");
+    printf("    const uint8_t sign = b[3] & 0x80 ? 0xFF : 0;\n");
+    printf("    uint8_t imm[4];\n\n");
+    printf("    switch (format) {\n");
+    for (int f = FMT_I; f < FMT_COUNT; f++) {
+        printf("    case DECODE_%s:\n", format_names[f]);
+        for (int byte = 0; byte < 4; byte++)
+            gen_imm_byte(f, byte);
+        printf("        break;\n");
+    }
+    printf("    default:\n        return 0;\n    }\n\n");
+    printf("    uint32_t x;\n");
+    printf("    memcpy(&x, imm, sizeof(x));\n");
+    printf("    return x;\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: gendecode ISAFILE > decode_table.h\n");
+        return 1;
+    }
+    isa_file = argv[1];
+    FILE *f = fopen(isa_file, "r");
+    if (!f) {
+        perror(isa_file);
+        return 1;
+    }
+    parse(f);
+    fclose(f);
+
+    printf("/* Generated by tools/gendecode from %s, do not edit */\n\n",
+           isa_file);
+    printf("#pragma once\n\n#include <string.h>\n\n");
+    printf("/* clang-format off */\n");
+    printf("enum {\n");
+    for (int i = 0; i < FMT_COUNT; i++)
+        printf("    DECODE_%s,\n", format_names[i]);
+    printf("};\n\n");
+    printf("#define DECODE_SUB 0x80\n\n");
+    printf("typedef struct {\n");
+    printf("    uint8_t mask[4], match[4]; /**< bytes of the word */\n");
+    printf("    uint8_t op;\n");
+    printf("} decode_pattern_t;\n\n");
+    gen_slots();
+    gen_formats();
+    gen_imm();
+    printf("/* clang-format on */\n");
+    return 0;
+}
@@ -0,0 +1,419 @@
+/* jitdiff: run random guest code on the host and print the final state
+ *
+ * usage: jitdiff [SEED [STEPS]]
+ *
+ * The Makefile builds it twice out of the semu sources, once with
+ * SEMU_FEATURE_JIT=0 and once with SEMU_FEATURE_JIT=1, JIT_HOT=1 and
+ * JIT_HOST, for which jit.c calls jit_host_call() below to run the
+ * translated blocks in a small 6502 simulator. For the same seed both have
+ * to print the same state, "make check-jit" compares them.
+ *
+ * The guest code is mostly register-only instructions and branches, the
+ * kind of blocks the JIT translates, mixed with loads, stores, CSR accesses,
+ * ecalls and junk that trap. Timer and external interrupts come and go, so
+ * that blocks are also entered right after an interrupt is taken.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "reu.h"
+#include "riscv.h"
+#include "riscv_private.h"
+
+#define CODE_SIZE 0x4000 /* random code at physical address 0 */
+#define DATA_END 0x8000  /* random data behind it */
+#define MMIO_BASE 0xF4000000
+
+static uint32_t *mem;
+static unsigned long mmio_count;
+
+/* The REU is a flat host array */
+
+uint32_t loadword_reu(uint32_t addr)
+{
+    return mem[(addr % RAM_SIZE) >> 2];
+}
+
+uint32_t fetchword_reu(uint32_t addr)
+{
+    return loadword_reu(addr);
+}
+
+void saveword_reu(uint32_t addr, uint32_t value)
+{
+    mem[(addr % RAM_SIZE) >> 2] = value;
+}
+
+void reu_read(void *dst, uint32_t addr, uint16_t len)
+{
+    memcpy(dst, (uint8_t *) mem + addr % RAM_SIZE, len);
+}
+
+void reu_fill(uint32_t addr, uint8_t value, uint16_t len)
+{
+    memset((uint8_t *) mem + addr % RAM_SIZE, value, len);
+}
+
+/* A single device that counts byte accesses */
+
+void bus_load_mmio(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value)
+{
+    if ((addr >> 20) == (MMIO_BASE >> 20) &&
+        (width == RV_MEM_LBU || width == RV_MEM_LB)) {
+        *value = mmio_count++ & 0x7f;
+        return;
+    }
+    vm_set_exception(vm, RV_EXC_LOAD_FAULT, vm->exc_val);
+}
+
+void bus_store_mmio(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value)
+{
+    if ((addr >> 20) == (MMIO_BASE >> 20) && width == RV_MEM_SB) {
+        mmio_count += value & 1;
+        return;
+    }
+    vm_set_exception(vm, RV_EXC_STORE_FAULT, vm->exc_val);
+}
+
+static void mem_fetch(vm_t *vm, uint32_t addr, uint32_t *value)
+{
+    if (addr >= RAM_SIZE) {
+        vm_set_exception(vm, RV_EXC_FETCH_FAULT, vm->exc_val);
+        return;
+    }
+    *value = fetchword_reu(addr & 0xfffffffc);
+}
+
+static void mem_load(vm_t *vm, uint32_t addr, uint8_t width, uint32_t *value)
+{
+    if (addr < RAM_SIZE)
+        ram_read(vm, NULL, addr, width, value);
+    else
+        bus_load_mmio(vm, addr, width, value);
+}
+
+static void mem_store(vm_t *vm, uint32_t addr, uint8_t width, uint32_t value)
+{
+    if (addr < RAM_SIZE)
+        ram_write(vm, NULL, addr, width, value);
+    else
+        bus_store_mmio(vm, addr, width, value);
+}
+
+#if SEMU_HAS(JIT)
+/* 6502 simulator for the opcodes jit_emit.c uses. The code runs in place,
+ * data accesses go to the 64K of M[] with the register file at JIT_HOST.
+ */
+static uint8_t M[0x10000];
+static uint8_t A, X, Y, C, Z, N, V;
+static unsigned long long sim_cycles, sim_calls;
+
+static void nz(uint8_t v)
+{
+    Z = !v;
+    N = v >> 7;
+}
+
+static void adc(uint8_t v)
+{
+    const unsigned s = A + v + C;
+    V = (~(A ^ v) & (A ^ s) & 0x80) != 0;
+    C = s > 0xff;
+    A = s;
+    nz(A);
+}
+
+static void sim_fail(const char *why, uint16_t pc)
+{
+    fprintf(stderr, "jitdiff: %s at +%04x of the block\n", why, pc);
+    exit(2);
+}
+
+uint8_t jit_host_call(vm_t *vm, const uint8_t *code)
+{
+    uint16_t pc = 0;
+    unsigned long steps = 0;
+
+    memcpy(M + JIT_HOST, vm->x_regs, sizeof(vm->x_regs));
+    A = rand(), X = rand(), Y = rand(), C = rand() & 1, V = rand() & 1;
+    sim_calls++;
+    for (;;) {
+        if (++steps > 100000)
+            sim_fail("runaway code", pc);
+        const uint8_t op = code[pc++];
+        const uint8_t i = code[pc];
+        const uint16_t a = i | code[pc + 1] << 8;
+#define ABS (pc += 2, sim_cycles += 4, a)
+#define IMM (pc += 1, sim_cycles += 2, i)
+#define IMP (sim_cycles += 2)
+#define BR(c)                      \
+    do {                           \
+        pc++;                      \
+        sim_cycles += 2;           \
+        if (c) {                   \
+            sim_cycles++;          \
+            pc += (int8_t) i;      \
+        }                          \
+    } while (0)
+        switch (op) {
+        case 0x09: A |= IMM; nz(A); break;
+        case 0x0D: A |= M[ABS]; nz(A); break;
+        case 0x29: A &= IMM; nz(A); break;
+        case 0x2D: A &= M[ABS]; nz(A); break;
+        case 0x49: A ^= IMM; nz(A); break;
+        case 0x4D: A ^= M[ABS]; nz(A); break;
+        case 0x69: adc(IMM); break;
+        case 0x6D: adc(M[ABS]); break;
+        case 0xE9: adc(~IMM); break;
+        case 0xED: adc(~M[ABS]); break;
+        case 0xA9: A = IMM; nz(A); break;
+        case 0xAD: A = M[ABS]; nz(A); break;
+        case 0xA2: X = IMM; nz(X); break;
+        case 0xA0: Y = IMM; nz(Y); break;
+        case 0x8D: M[ABS] = A; break;
+        case 0x8E: M[ABS] = X; break;
+        case 0xC9: { const uint8_t v = IMM; C = A >= v; nz(A - v); break; }
+        case 0xCD: { const uint8_t v = M[ABS]; C = A >= v; nz(A - v); break; }
+        case 0x0A: IMP; C = A >> 7; A <<= 1; nz(A); break;
+        case 0x2A: { IMP; const uint8_t c = A >> 7; A = A << 1 | C; C = c; nz(A); break; }
+        case 0x4A: IMP; C = A & 1; A >>= 1; nz(A); break;
+        case 0x6A: { IMP; const uint8_t c = A & 1; A = A >> 1 | C << 7; C = c; nz(A); break; }
+        case 0x0E: { const uint16_t p = ABS; IMP; C = M[p] >> 7; M[p] <<= 1; nz(M[p]); break; }
+        case 0x2E: { const uint16_t p = ABS; IMP; const uint8_t c = M[p] >> 7; M[p] = M[p] << 1 | C; C = c; nz(M[p]); break; }
+        case 0x4E: { const uint16_t p = ABS; IMP; C = M[p] & 1; M[p] >>= 1; nz(M[p]); break; }
+        case 0x6E: { const uint16_t p = ABS; IMP; const uint8_t c = M[p] & 1; M[p] = M[p] >> 1 | C << 7; C = c; nz(M[p]); break; }
+        case 0x18: IMP; C = 0; break;
+        case 0x38: IMP; C = 1; break;
+        case 0xCA: IMP; X--; nz(X); break;
+        case 0xE8: IMP; X++; nz(X); break;
+        case 0x88: IMP; Y--; nz(Y); break;
+        case 0xAA: IMP; X = A; nz(X); break;
+        case 0x8A: IMP; A = X; nz(A); break;
+        case 0x10: BR(!N); break;
+        case 0x30: BR(N); break;
+        case 0x50: BR(!V); break;
+        case 0x70: BR(V); break;
+        case 0x90: BR(!C); break;
+        case 0xB0: BR(C); break;
+        case 0xD0: BR(!Z); break;
+        case 0xF0: BR(Z); break;
+        case 0x60:
+            sim_cycles += 6 + 6; /* with the jsr */
+            memcpy(vm->x_regs, M + JIT_HOST, sizeof(vm->x_regs));
+            if (vm_get_reg(vm, 0))
+                sim_fail("x0 written", pc - 1);
+            if (A > 1)
+                sim_fail("bad exit", pc - 1);
+            return A;
+        default:
+            sim_fail("unknown opcode", pc - 1);
+        }
+#undef ABS
+#undef IMM
+#undef IMP
+#undef BR
+    }
+}
+#endif
+
+/* Random guest code */
+
+static uint64_t seed = 88172645463325252ULL;
+
+static uint32_t rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (uint32_t) seed;
+}
+
+#define R(n) (rnd() % (n))
+
+static uint32_t reg(void)
+{
+    return R(4) ? 1 + R(15) : R(32);
+}
+
+static uint32_t imm12(void)
+{
+    static const int16_t v[] = {0, 1, -1, 4, 8, -4, 2047, -2048, 16, 31};
+    if (!R(3))
+        return v[R(ARRAY_SIZE(v))] & 0xfff;
+    return (R(256) - 128) & 0xfff;
+}
+
+static uint32_t enc_i(uint32_t op, uint32_t f3, uint32_t rd, uint32_t rs1,
+                      uint32_t imm)
+{
+    return imm << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+}
+
+static uint32_t enc_r(uint32_t f3, uint32_t f7, uint32_t rd, uint32_t rs1,
+                      uint32_t rs2)
+{
+    return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | 0x33;
+}
+
+static uint32_t enc_s(uint32_t f3, uint32_t rs1, uint32_t rs2, uint32_t imm)
+{
+    return (imm >> 5) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 |
+           (imm & 31) << 7 | 0x23;
+}
+
+static uint32_t enc_b(uint32_t f3, uint32_t rs1, uint32_t rs2, int32_t off)
+{
+    const uint32_t i = off;
+    return ((i >> 12) & 1) << 31 | ((i >> 5) & 63) << 25 | rs2 << 20 |
+           rs1 << 15 | f3 << 12 | ((i >> 1) & 15) << 8 | ((i >> 11) & 1) << 7 |
+           0x63;
+}
+
+static uint32_t enc_j(uint32_t rd, int32_t off)
+{
+    const uint32_t i = off;
+    return ((i >> 20) & 1) << 31 | ((i >> 1) & 1023) << 21 |
+           ((i >> 11) & 1) << 20 | ((i >> 12) & 255) << 12 | rd << 7 | 0x6f;
+}
+
+static uint32_t gen(void)
+{
+    static const uint16_t csrs[] = {0x100, 0x104, 0x105, 0x140, 0x141,
+                                    0x142, 0x143, 0x144, 0xC00, 0xC01,
+                                    0xC02, 0xC80, 0xC81, 0x180};
+    switch (R(32)) {
+    case 0 ... 9: {
+        uint32_t f3 = R(8), imm = imm12();
+        if (f3 == 1)
+            imm &= 31;
+        if (f3 == 5)
+            imm = (imm & 31) | (R(2) ? 0x400 : 0);
+        return enc_i(0x13, f3, reg(), reg(), imm);
+    }
+    case 10 ... 14:
+        return enc_r(R(8), R(4) ? 0 : (R(2) ? 0x20 : 1), reg(), reg(),
+                     R(3) ? reg() : 0);
+    case 15:
+        return R(0x100000) << 12 | reg() << 7 | 0x37;
+    case 16:
+        return R(4) << 12 | reg() << 7 | 0x17;
+    case 17 ... 21:
+        return enc_b(R(8), reg(), R(3) ? reg() : 0,
+                     (int32_t) (R(32) - 24) * 4);
+    case 22:
+        return enc_j(R(2) ? 0 : reg(), (int32_t) (R(64) - 40) * 4);
+    case 23:
+        return enc_i(0x67, 0, R(2) ? 0 : reg(), reg(), imm12() & ~3);
+    case 24 ... 25:
+        return enc_i(0x03, R(8), reg(), reg(), imm12());
+    case 26 ... 27:
+        return enc_s(R(4), reg(), reg(), imm12());
+    case 28:
+        return enc_i(0x73, 1 + R(3), R(3) ? reg() : 0, R(3) ? reg() : 0,
+                     csrs[R(ARRAY_SIZE(csrs))]);
+    case 29:
+        return R(2) ? 0x00000073 : 0x10200073; /* ecall, sret */
+    default:
+        return rnd();
+    }
+}
+
+static void dump(const vm_t *vm, unsigned long traps)
+{
+    uint64_t h = 1469598103934665603ULL;
+    for (uint32_t a = 0; a < DATA_END; a += 4)
+        h = (h ^ loadword_reu(a)) * 1099511628211ULL;
+
+    printf("pc=%08x current_pc=%08x insn_count=%08x:%08x traps=%lu\n", vm->pc,
+           vm->current_pc, vm->insn_count_hi, vm->insn_count, traps);
+    for (uint8_t i = 0; i < 32; i++)
+        printf("%08x%c", vm_get_reg(vm, i), (i & 7) == 7 ? '\n' : ' ');
+    printf("sepc=%08x scause=%08x stval=%08x sie=%x sip=%x mem=%016llx "
+           "mmio=%lu\n",
+           vm->sepc, vm->scause, vm->stval, vm->sie, vm->sip,
+           (unsigned long long) h, mmio_count);
+}
+
+int main(int argc, char **argv)
+{
+    static emu_state_t emu;
+    static vm_t vm;
+    const unsigned long steps = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+    unsigned long done = 0, traps = 0;
+    uint32_t timer = 3000;
+
+    if (argc > 1)
+        seed ^= strtoull(argv[1], NULL, 0) * 0x9E3779B97F4A7C15ULL;
+    mem = calloc(RAM_SIZE, 1);
+    if (!mem)
+        return 1;
+    for (uint32_t a = 0; a < CODE_SIZE; a += 4)
+        mem[a >> 2] = gen();
+    for (uint32_t a = CODE_SIZE; a < DATA_END; a += 4)
+        mem[a >> 2] = rnd();
+
+    vm.priv = &emu;
+    vm.mem_fetch = mem_fetch;
+    vm.mem_load = mem_load;
+    vm.mem_store = mem_store;
+    vm.s_mode = true;
+    vm.stvec_addr = 0x100;
+    vm.sie = RV_INT_STI_BIT | RV_INT_SEI_BIT;
+    for (uint8_t i = 1; i < 32; i++)
+        vm_set_reg(&vm, i, i < 16 ? CODE_SIZE + R(DATA_END - CODE_SIZE) : rnd());
+    vm_set_reg(&vm, 31, MMIO_BASE);
+
+    while (done < steps) {
+        /* every 256 steps: interrupts and now and then a jump elsewhere */
+        if (vm.insn_count > timer)
+            vm.sip |= RV_INT_STI_BIT;
+        else
+            vm.sip &= ~RV_INT_STI_BIT;
+        if ((done >> 12) & 1)
+            vm.sip |= RV_INT_SEI_BIT;
+        else
+            vm.sip &= ~RV_INT_SEI_BIT;
+        if ((done >> 9) & 1)
+            vm_sstatus_set(&vm, SIE);
+        else
+            vm_sstatus_clear(&vm, SIE);
+        vm_update_irq(&vm);
+        if (!(done & 0x7ff))
+            vm.pc = R(CODE_SIZE / 4) * 4;
+
+        for (uint16_t left = 256; left && done < steps;) {
+            uint16_t budget = steps - done < left ? steps - done : left;
+            vm_run(&vm, budget);
+            budget -= vm.budget;
+            done += budget;
+            left -= budget;
+            if (!vm.error)
+                continue;
+            traps++;
+            if (vm.error != ERR_EXCEPTION) {
+                fprintf(stderr, "jitdiff: unexpected error\n");
+                return 1;
+            }
+            if (vm.exc_cause == RV_EXC_ECALL_S) {
+                /* play SBI: set the timer */
+                timer = vm.insn_count + (vm_get_reg(&vm, 10) & 0xffff);
+                vm_set_reg(&vm, 10, (uint32_t) -2);
+                vm.error = ERR_NONE;
+                continue;
+            }
+            /* play kernel: skip the faulting instruction */
+            vm_trap(&vm);
+            vm.pc = (vm.sepc + 4) % CODE_SIZE;
+            if (!R(4))
+                vm.pc = R(CODE_SIZE / 4) * 4;
+        }
+    }
+#if SEMU_HAS(JIT)
+    fprintf(stderr, "jitdiff: %llu blocks run in %llu cycles\n", sim_calls,
+            sim_cycles);
+#endif
+    dump(&vm, traps);
+    return 0;
+}
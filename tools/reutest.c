@@ -0,0 +1,130 @@
+/* reutest: run random accesses through the REU word cache on the host
+ *
+ * usage: reutest [SEED [STEPS]]
+ *
+ * The Makefile builds reu.c with REU_HOST into this twice, once with
+ * SEMU_FEATURE_REU_WRITEBACK=0 and once with =1. reu_dma() below does the
+ * transfers on a flat array standing in for the REU, and every load, fetch
+ * and block read is checked against a second array that takes the stores
+ * directly, and no line may be written back that has not changed. At the
+ * end the cache is flushed and the REU has to match that array byte for
+ * byte. Both builds print the same hit and miss counts and a hash of the
+ * REU, "make check-reu" compares them.
+ *
+ * The accesses stay in a few lines per set, so that lines are replaced all
+ * the time, dirty ones included with REU_WRITEBACK.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reu.h"
+
+#define SPAN (REU_CACHE_SETS * REU_CACHE_LINE * (REU_CACHE_WAYS + 2))
+
+static uint8_t *reu; /* behind the cache */
+static uint8_t *ref; /* what the guest stored */
+
+void reu_dma(volatile void *c64, uint32_t addr, uint16_t len, uint8_t cmd,
+             uint8_t ctrl)
+{
+    volatile uint8_t *p = c64;
+    uint32_t n = len ? len : 0x10000;
+
+    /*
+     * a line is only written back after a store to it, and the stores are
+     * random words, so writing back one that is the same as in the REU
+     * means a clean line was taken for a dirty one
+     */
+    if (!(cmd & REU_CMD_REU_TO_C64) && !ctrl && len == REU_CACHE_LINE &&
+        !memcmp((const void *) p, &reu[addr], len)) {
+        printf("write-back of a clean line at 0x%06x\n", addr);
+        exit(1);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        volatile uint8_t *c = ctrl & REU_ADDR_FIX_C64 ? p : p + i;
+        uint8_t *r = &reu[(addr + i) % REU_SIZE];
+        if (cmd & REU_CMD_REU_TO_C64)
+            *c = *r;
+        else
+            *r = *c;
+    }
+}
+
+static uint32_t ref_word(uint32_t addr)
+{
+    uint32_t w;
+
+    memcpy(&w, &ref[addr], 4);
+    return w;
+}
+
+static void fail(const char *what, unsigned long step, uint32_t addr)
+{
+    printf("%s mismatch at step %lu, address 0x%06x\n", what, step, addr);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[0x800];
+    unsigned seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    unsigned long steps = argc > 2 ? strtoul(argv[2], NULL, 0) : 1000000;
+
+    reu = malloc(REU_SIZE);
+    ref = malloc(REU_SIZE);
+    if (!reu || !ref)
+        return 1;
+    srand(seed);
+    for (uint32_t i = 0; i < REU_SIZE; i++)
+        reu[i] = ref[i] = rand();
+
+    for (unsigned long step = 0; step < steps; step++) {
+        /* half of the time near the top of the REU, the rest near 0 */
+        uint32_t base = rand() & 1 ? REU_SIZE - SPAN : 0;
+        uint32_t addr = base + (rand() % SPAN & ~3U);
+        int op = rand() % 1000;
+
+        if (op < 500) {
+            if (loadword_reu(addr) != ref_word(addr))
+                fail("load", step, addr);
+        } else if (op < 700) {
+            /* a run of fetches, as for straight code */
+            for (int n = rand() % 64 + 1; n && addr < REU_SIZE; n--) {
+                if (fetchword_reu(addr) != ref_word(addr))
+                    fail("fetch", step, addr);
+                addr += 4;
+            }
+        } else if (op < 990) {
+            uint32_t w = rand() ^ (uint32_t) rand() << 16;
+            if (op & 1) /* ram.c loads the word before a byte store */
+                loadword_reu(addr);
+            saveword_reu(addr, w);
+            memcpy(&ref[addr], &w, 4);
+        } else if (op < 995) {
+            uint16_t len = (rand() % sizeof(buf) & ~3U) + 4;
+            uint8_t value = rand();
+            if (addr + len > REU_SIZE)
+                len = REU_SIZE - addr;
+            reu_fill(addr, value, len);
+            memset(&ref[addr], value, len);
+        } else {
+            uint16_t len = rand() % sizeof(buf) + 1;
+            if (addr + len > REU_SIZE)
+                len = REU_SIZE - addr;
+            reu_read(buf, addr, len);
+            if (memcmp(buf, &ref[addr], len))
+                fail("read", step, addr);
+        }
+    }
+
+    reu_flush();
+    if (memcmp(reu, ref, REU_SIZE))
+        fail("flush", steps, 0);
+
+    uint32_t hash = 2166136261U;
+    for (uint32_t i = 0; i < REU_SIZE; i++)
+        hash = (hash ^ reu[i]) * 16777619U;
+    printf("hits %u misses %u reu %08x\n", reu_hits, reu_misses, hash);
+    return 0;
+}